@@ -0,0 +1,117 @@
+#include "thorin/analyses/alias.h"
+
+#include "thorin/primop.h"
+
+namespace thorin {
+
+bool is_safe_bitcast(const Bitcast* bitcast) {
+    // Support cast between pointers to definite and indefinite arrays
+    auto ptr_to   = bitcast->type()->isa<PtrType>();
+    auto ptr_from = bitcast->from()->type()->isa<PtrType>();
+    if (!ptr_to || !ptr_from)
+        return false;
+    auto array_to   = ptr_to->pointee()->isa<IndefiniteArrayType>();
+    auto array_from = ptr_from->pointee()->isa<DefiniteArrayType>();
+    if (!array_to || !array_from)
+        return false;
+    if (array_to->elem_type() != array_from->elem_type())
+        return false;
+    return true;
+}
+
+bool is_mem_object(const Def* def) {
+    return def->isa<Slot>() || def->isa<Global>() || Alloc::is_out_ptr(def);
+}
+
+const MemLoc& AliasAnalysis::mem_loc(const Def* ptr) {
+    auto i = locs_.find(ptr);
+    if (i != locs_.end())
+        return i->second;
+
+    MemLoc loc;
+    auto def = ptr;
+    while (true) {
+        if (auto bitcast = def->isa<Bitcast>()) {
+            if (!bitcast->from()->type()->isa<PtrType>())
+                break;
+            loc.exact &= is_safe_bitcast(bitcast);
+            def = bitcast->from();
+        } else if (auto lea = def->isa<LEA>()) {
+            loc.path.push_back(lea->index());
+            def = lea->ptr();
+        } else {
+            break;
+        }
+    }
+    loc.base = def;
+    std::reverse(loc.path.begin(), loc.path.end());
+    return locs_[ptr] = std::move(loc);
+}
+
+bool AliasAnalysis::escapes(const Def* base) {
+    // mutable globals can be accessed by anyone holding the symbol
+    if (auto global = base->isa<Global>()) {
+        if (global->is_mutable())
+            return true;
+    }
+    return leaks(base);
+}
+
+bool AliasAnalysis::leaks(const Def* def) {
+    auto i = escapes_.find(def);
+    if (i != escapes_.end())
+        return i->second;
+
+    bool result = false;
+    for (auto use : def->uses()) {
+        if (use->isa<Store>()) {
+            result = use.index() != 1;
+        } else if (use->isa<LEA>()) {
+            result = leaks(use.def());
+        } else if (auto bitcast = use->isa<Bitcast>()) {
+            result = !is_safe_bitcast(bitcast) || leaks(use.def());
+        } else {
+            result = !use->isa<Load>();
+        }
+        if (result)
+            break;
+    }
+    return escapes_[def] = result;
+}
+
+AliasResult AliasAnalysis::alias(const Def* ptr1, const Def* ptr2) {
+    if (ptr1 == ptr2)
+        return AliasResult::MustAlias;
+
+    // copy: mem_loc may rehash locs_
+    auto loc1 = mem_loc(ptr1);
+    auto& loc2 = mem_loc(ptr2);
+
+    if (loc1.base != loc2.base) {
+        bool obj1 = is_mem_object(loc1.base);
+        bool obj2 = is_mem_object(loc2.base);
+        if (obj1 && obj2)
+            return AliasResult::NoAlias;
+        if ((obj1 && !escapes(loc1.base)) || (obj2 && !escapes(loc2.base)))
+            return AliasResult::NoAlias;
+        return AliasResult::MayAlias;
+    }
+
+    if (!loc1.exact || !loc2.exact)
+        return AliasResult::MayAlias;
+
+    for (size_t i = 0, e = std::min(loc1.path.size(), loc2.path.size()); i != e; ++i) {
+        auto index1 = loc1.path[i], index2 = loc2.path[i];
+        if (index1 == index2)
+            continue;
+        if (index1->isa<PrimLit>() && index2->isa<PrimLit>()
+            && primlit_value<int64_t>(index1) != primlit_value<int64_t>(index2))
+            return AliasResult::NoAlias;
+        return AliasResult::MayAlias;
+    }
+
+    // one path is a prefix of the other: the shorter one contains the longer one
+    return loc1.path.size() == loc2.path.size() ? AliasResult::MustAlias : AliasResult::MayAlias;
+}
+
+}
@@ -0,0 +1,52 @@
+#ifndef THORIN_ANALYSES_ALIAS_H
+#define THORIN_ANALYSES_ALIAS_H
+
+#include <vector>
+
+#include "thorin/def.h"
+
+namespace thorin {
+
+class Bitcast;
+
+enum class AliasResult { NoAlias, MayAlias, MustAlias };
+
+/**
+ * A pointer decomposed into the object it points into and the @p LEA indices used to reach it.
+ * The @p base is a @p Slot, the pointer of an @p Alloc, a @p Global or any other pointer we cannot look through.
+ */
+struct MemLoc {
+    const Def* base = nullptr;
+    std::vector<const Def*> path; ///< Outermost index first.
+    bool exact = true;            ///< @c false if a bitcast that changes the layout was traversed; @p path is unusable then.
+};
+
+/// Is @p bitcast a cast between pointers to a definite and an indefinite array with the same element type?
+bool is_safe_bitcast(const Bitcast* bitcast);
+/// Is @p def a @p Slot, the pointer of an @p Alloc or a @p Global?
+bool is_mem_object(const Def* def);
+
+/**
+ * Field-sensitive alias analysis for pointers.
+ * Distinct memory objects never alias.
+ * Pointers into the same object do not alias if their paths differ in a constant index.
+ * An object whose address never escapes cannot alias a pointer of unknown origin.
+ * Results are cached; the cache stays valid as long as no new uses of pointers are introduced.
+ */
+class AliasAnalysis {
+public:
+    AliasResult alias(const Def* ptr1, const Def* ptr2);
+    const MemLoc& mem_loc(const Def* ptr);
+    /// Is the address of @p base used by anything else but loads, stores, @p LEA%s or safe bitcasts?
+    bool escapes(const Def* base);
+
+private:
+    bool leaks(const Def* def);
+
+    DefMap<MemLoc> locs_;
+    DefMap<bool> escapes_;
+};
+
+}
+
+#endif
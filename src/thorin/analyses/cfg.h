@@ -1,6 +1,7 @@
 #ifndef THORIN_ANALYSES_CFG_H
 #define THORIN_ANALYSES_CFG_H
 
+#include <atomic>
 #include <vector>
 
 #include "thorin/analyses/scope.h"
@@ -45,7 +46,7 @@ private:
 
     Continuation* continuation_;
     size_t gid_;
-    static uint64_t gid_counter_;
+    static std::atomic<uint64_t> gid_counter_; ///< CFGs of different scopes may be built concurrently.
     mutable CFNodes preds_;
     mutable CFNodes succs_;
 
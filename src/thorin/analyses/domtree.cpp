@@ -2,57 +2,144 @@
 
 namespace thorin {
 
+static size_t floor_log2(size_t n) {
+    size_t result = 0;
+    while (n >>= size_t(1))
+        ++result;
+    return result;
+}
+
 template<bool forward>
 void DomTreeBase<forward>::create() {
-    // Cooper et al, 2001. A Simple, Fast Dominance Algorithm. http://www.cs.rice.edu/~keith/EMBED/dom.pdf
-
-    // all idoms different from entry are set to their first found dominating pred
-    for (auto n : cfg().reverse_post_order().skip_front()) {
-        for (auto pred : cfg().preds(n)) {
-            if (cfg().index(pred) < cfg().index(n)) {
-                idoms_[n] = pred;
-                goto outer_loop;
-            }
+    // Semi-NCA as described in Georgiadis, 2005. Linear-Time Algorithms for Dominators and Related Problems.
+    // All indices below are DFS pre-order numbers.
+    static const size_t none = size_t(-1);
+    typename CFG<forward>::template Map<size_t> dfs(cfg(), none);
+    std::vector<const CFNode*> vertex;
+    std::vector<size_t> parent;
+    vertex.reserve(cfg().size());
+    parent.reserve(cfg().size());
+
+    // iterative DFS; an entry remembers the node that pushed it as parent
+    std::vector<std::pair<const CFNode*, size_t>> stack;
+    stack.emplace_back(cfg().entry(), none);
+    while (!stack.empty()) {
+        auto n = stack.back().first;
+        auto p = stack.back().second;
+        stack.pop_back();
+        if (dfs[n] != none)
+            continue;
+        dfs[n] = vertex.size();
+        vertex.push_back(n);
+        parent.push_back(p);
+        for (auto succ : cfg().succs(n)) {
+            if (dfs[succ] == none)
+                stack.emplace_back(succ, dfs[n]);
         }
-        THORIN_UNREACHABLE;
-outer_loop:;
     }
 
-    for (bool todo = true; todo;) {
-        todo = false;
+    auto num = vertex.size();
+    assert(num == cfg().size() && "all nodes must be reachable");
+    std::vector<size_t> semi(num), label(num), ancestor(num, none), idom(num), path;
+    for (size_t v = 0; v != num; ++v)
+        semi[v] = label[v] = v;
 
-        for (auto n : cfg().reverse_post_order().skip_front()) {
-            const CFNode* new_idom = nullptr;
-            for (auto pred : cfg().preds(n))
-                new_idom = new_idom ? lca(new_idom, pred) : pred;
+    // returns the vertex with minimal semi-dominator on the path to the root of v's tree in the forest
+    auto eval = [&] (size_t v) {
+        if (ancestor[v] == none)
+            return v;
+        for (auto u = v; ancestor[ancestor[u]] != none; u = ancestor[u])
+            path.push_back(u);
+        // path compression, starting next to the root
+        while (!path.empty()) {
+            auto u = path.back();
+            path.pop_back();
+            auto a = ancestor[u];
+            if (semi[label[a]] < semi[label[u]])
+                label[u] = label[a];
+            ancestor[u] = ancestor[a];
+        }
+        return label[v];
+    };
 
-            assert(new_idom);
-            if (idom(n) != new_idom) {
-                idoms_[n] = new_idom;
-                todo = true;
-            }
+    // compute semi-dominators in reverse pre-order
+    for (size_t w = num - 1; w > 0; --w) {
+        for (auto pred : cfg().preds(vertex[w])) {
+            auto u = eval(dfs[pred]);
+            if (semi[u] < semi[w])
+                semi[w] = semi[u];
         }
+        ancestor[w] = parent[w];
+    }
+
+    // the idom is the nearest common ancestor of the parent and the semi-dominator
+    idom[0] = 0;
+    for (size_t w = 1; w != num; ++w) {
+        auto d = parent[w];
+        while (d > semi[w])
+            d = idom[d];
+        idom[w] = d;
+        idoms_[vertex[w]] = vertex[d];
     }
 
     for (auto n : cfg().reverse_post_order().skip_front())
-        children_[idom(n)].push_back(n);
+        children_[idoms_[n]].push_back(n);
 }
 
 template<bool forward>
-void DomTreeBase<forward>::depth(const CFNode* n, int i) {
-    depth_[n] = i;
-    for (auto child : children(n))
-        depth(child, i+1);
+void DomTreeBase<forward>::number() {
+    // walk the tree iteratively to assign depth and pre-/post-order numbers
+    size_t pre = 0, post = 0;
+    std::vector<std::pair<const CFNode*, size_t>> stack;
+    auto enter = [&] (const CFNode* n, int depth) {
+        depth_[n] = depth;
+        pre_[n] = pre++;
+        pre_order_.push_back(n);
+        stack.emplace_back(n, 0);
+    };
+
+    pre_order_.reserve(cfg().size());
+    enter(root(), 0);
+    while (!stack.empty()) {
+        auto n = stack.back().first;
+        auto i = stack.back().second++;
+        if (i != children(n).size()) {
+            enter(children(n)[i], depth(n) + 1);
+        } else {
+            post_[n] = post++;
+            stack.pop_back();
+        }
+    }
+
+    // Sparse table for range minimum queries over the depths in pre-order.
+    // Entries pack the depth above the pre-order number, so a plain min finds the shallowest node.
+    auto num = pre_order_.size();
+    sparse_.resize(num);
+    for (size_t i = 0; i != num; ++i)
+        sparse_[i] = (uint64_t(depth(pre_order_[i])) << 32_u64) | uint64_t(i);
+    for (size_t k = 1, w = 2; w <= num; ++k, w *= 2) {
+        sparse_.resize((k + 1) * num);
+        auto prev = sparse_.data() + (k - 1) * num;
+        auto row = prev + num;
+        for (size_t i = 0; i + w <= num; ++i)
+            row[i] = std::min(prev[i], prev[i + w / 2]);
+    }
 }
 
 template<bool forward>
 const CFNode* DomTreeBase<forward>::lca(const CFNode* i, const CFNode* j) const {
     assert(i && j);
-    while (index(i) != index(j)) {
-        while (index(i) < index(j)) j = idom(j);
-        while (index(j) < index(i)) i = idom(i);
-    }
-    return i;
+    if (i == j)
+        return i;
+    // The shallowest node in the pre-order range (i, j] is the child of the lca on the path to j.
+    auto l = pre_[i], r = pre_[j];
+    if (l > r)
+        std::swap(l, r);
+    ++l;
+    auto k = floor_log2(r - l + 1);
+    auto row = sparse_.data() + k * pre_order_.size();
+    auto min = std::min(row[l], row[r + 1 - (size_t(1) << k)]);
+    return idom(pre_order_[min & 0xFFFFFFFF_u64]);
 }
 
 template<bool forward>
@@ -10,6 +10,8 @@ namespace thorin {
  * The template parameter @p forward determines
  * whether a regular dominance tree (@c true) or a post-dominance tree (@c false) should be constructed.
  * This template parameter is associated with @p CFG's @c forward parameter.
+ * The tree is numbered in pre- and post-order and the depths in pre-order are kept in a sparse table,
+ * so @p dominates and @p lca are answered in constant time.
  */
 template<bool forward>
 class DomTreeBase : public YComp {
@@ -23,28 +25,36 @@ public:
         , children_(cfg)
         , idoms_(cfg)
         , depth_(cfg)
+        , pre_(cfg)
+        , post_(cfg)
     {
         create();
-        depth(root(), 0);
+        number();
     }
 
     const CFG<forward>& cfg() const { return cfg_; }
     size_t index(const CFNode* n) const { return cfg().index(n); }
     const std::vector<const CFNode*>& children(const CFNode* n) const { return children_[n]; }
-    const CFNode* root() const { return *idoms_.begin(); }
+    const CFNode* root() const { return cfg().entry(); }
     const CFNode* idom(const CFNode* n) const { return idoms_[n]; }
     int depth(const CFNode* n) const { return depth_[n]; }
+    /// Does @p i dominate @p j? Every node dominates itself.
+    bool dominates(const CFNode* i, const CFNode* j) const { return pre_[i] <= pre_[j] && post_[j] <= post_[i]; }
     const CFNode* lca(const CFNode* i, const CFNode* j) const; ///< Returns the least common ancestor of @p i and @p j.
     virtual void stream_ycomp(std::ostream& out) const override;
 
 private:
     void create();
-    void depth(const CFNode* n, int i);
+    void number();
 
     const CFG<forward>& cfg_;
     typename CFG<forward>::template Map<std::vector<const CFNode*>> children_;
     typename CFG<forward>::template Map<const CFNode*> idoms_;
     typename CFG<forward>::template Map<int> depth_;
+    typename CFG<forward>::template Map<size_t> pre_;
+    typename CFG<forward>::template Map<size_t> post_;
+    std::vector<const CFNode*> pre_order_;
+    std::vector<uint64_t> sparse_; ///< Row @c k holds depth and pre-order number of the shallowest node of each window of size @c 2^k.
 };
 
 typedef DomTreeBase<true>  DomTree;
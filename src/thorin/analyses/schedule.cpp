@@ -12,10 +12,11 @@
 
 namespace thorin {
 
-typedef DefMap<const CFNode*> Def2CFNode;
-
-//------------------------------------------------------------------------------
-
+/**
+ * Numbers all defs of the scope densely once and keeps every per-def property in arrays indexed by that number.
+ * The reachable @p Continuation%s come first in reverse post-order, followed by all other defs in breadth-first order.
+ * Operand and use lists are stored in compressed form.
+ */
 class Scheduler {
 public:
     Scheduler(const Scope& scope, Schedule& schedule)
@@ -23,146 +24,195 @@ public:
         , cfg_(scope.f_cfg())
         , domtree_(cfg_.domtree())
         , looptree_(cfg_.looptree())
-        , schedule_(schedule)
     {
-        compute_def2uses();
-        Def2CFNode* def2node = nullptr;
+        number_defs();
+        topo_sort();
 
         switch (schedule.tag()) {
-            case Schedule::Early: schedule_early(); def2node = &def2early_; break;
-            case Schedule::Late:  schedule_late();  def2node = &def2late_;  break;
-            case Schedule::Smart: schedule_smart(); def2node = &def2smart_; break;
+            case Schedule::Early: schedule_early(); break;
+            case Schedule::Late:  schedule_late();  break;
+            case Schedule::Smart: schedule_early(); schedule_late(); schedule_smart(); break;
+            case Schedule::Remat: schedule_early(); schedule_late(); schedule_remat(); break;
         }
 
-        for (const auto& p : *def2node) {
-            if (auto primop = p.first->isa<PrimOp>())
-                schedule[p.second].primops_.push_back(primop);
-        }
-
-        topo_sort(*def2node);
-    }
-
-    void for_all_primops(std::function<void(const PrimOp*)> f) {
-        for (const auto& p : def2uses_) {
-            if (auto primop = p.first->isa<PrimOp>())
-                f(primop);
+        // topo_ lists operands before their users, so each block ends up topologically sorted as well
+        for (auto i : topo_) {
+            if (auto primop = defs_[i]->isa<PrimOp>())
+                schedule[result_[i]].primops_.push_back(primop);
         }
     }
 
-    const Uses& uses(const Def* def) const { return def2uses_.find(def)->second; }
-    void compute_def2uses();
-    void schedule_early() { for_all_primops([&](const PrimOp* primop) { schedule_early(primop); }); }
-    void schedule_late()  { for_all_primops([&](const PrimOp* primop) { schedule_late (primop); }); }
-    void schedule_smart() { for_all_primops([&](const PrimOp* primop) { schedule_smart(primop); }); }
-    const CFNode* schedule_early(const Def*);
-    const CFNode* schedule_late(const Def*);
-    const CFNode* schedule_smart(const PrimOp*);
-    void topo_sort(Def2CFNode&);
-
 private:
+    size_t num_defs() const { return defs_.size(); }
+    ArrayRef<size_t> ops(size_t i) const { return ArrayRef<size_t>(op_list_.data() + op_begin_[i], op_begin_[i+1] - op_begin_[i]); }
+    ArrayRef<size_t> uses(size_t i) const { return ArrayRef<size_t>(use_list_.data() + use_begin_[i], use_begin_[i+1] - use_begin_[i]); }
+    const CFNode* lca(const CFNode* n, const CFNode* m) const { return n ? domtree_.lca(n, m) : m; }
+
+    void number_defs();
+    void topo_sort();
+    void schedule_early();
+    void schedule_late();
+    void schedule_smart();
+    void schedule_remat();
+    const CFNode* shallowest_loop(const PrimOp*, const CFNode* early, const CFNode* late);
+
     const Scope& scope_;
     const F_CFG& cfg_;
     const DomTree& domtree_;
     const LoopTree<true>& looptree_;
-    DefMap<Uses> def2uses_;
-    Def2CFNode def2early_;
-    Def2CFNode def2late_;
-    Def2CFNode def2smart_;
-    Schedule& schedule_;
+    size_t num_continuations_;
+    std::vector<const Def*> defs_;
+    std::vector<size_t> op_begin_, op_list_;
+    std::vector<size_t> use_begin_, use_list_;
+    std::vector<size_t> topo_;
+    std::vector<const CFNode*> early_;
+    std::vector<const CFNode*> late_;
+    std::vector<const CFNode*> result_;
 };
 
-void Scheduler::compute_def2uses() {
-    std::queue<const Def*> queue;
-    DefSet done;
-
-    auto enqueue = [&](const Def* def, size_t i, const Def* op) {
-        if (scope_.contains(op)) {
-            auto p1 = def2uses_[op].emplace(i, def);
-            assert_unused(p1.second);
-            auto p2 = done.emplace(op);
-            if (p2.second)
-                queue.push(op);
-        }
+void Scheduler::number_defs() {
+    DefMap<size_t> def2index;
+
+    auto number = [&](const Def* def) {
+        auto p = def2index.emplace(def, defs_.size());
+        if (p.second)
+            defs_.push_back(def);
+        return p.first->second;
     };
 
     for (auto n : cfg_.reverse_post_order()) {
-        queue.push(n->continuation());
-        auto p = done.emplace(n->continuation());
-        assert_unused(p.second);
+        auto i = number(n->continuation());
+        assert_unused(i == cfg_.index(n));
     }
+    num_continuations_ = defs_.size();
 
-    while (!queue.empty()) {
-        auto def = pop(queue);
-        for (size_t i = 0, e = def->num_ops(); i != e; ++i) {
+    // defs_ doubles as the queue of the breadth-first search
+    op_begin_.push_back(0);
+    for (size_t i = 0; i != defs_.size(); ++i) {
+        auto def = defs_[i];
+        for (auto op : def->ops()) {
             // all reachable continuations have already been registered above
             // NOTE we might still see references to unreachable continuations in the schedule
-            if (!def->op(i)->isa<Continuation>())
-                enqueue(def, i, def->op(i));
+            if (!op->isa<Continuation>() && scope_.contains(op))
+                op_list_.push_back(number(op));
         }
+        op_begin_.push_back(op_list_.size());
     }
-}
 
-const CFNode* Scheduler::schedule_early(const Def* def) {
-    auto i = def2early_.find(def);
-    if (i != def2early_.end())
-        return i->second;
+    // invert the operand lists
+    use_begin_.assign(num_defs() + 1, 0);
+    for (auto op : op_list_)
+        ++use_begin_[op + 1];
+    for (size_t i = 0, e = num_defs(); i != e; ++i)
+        use_begin_[i + 1] += use_begin_[i];
+    use_list_.resize(op_list_.size());
+    std::vector<size_t> pos(use_begin_.begin(), use_begin_.end() - 1);
+    for (size_t i = 0, e = num_defs(); i != e; ++i) {
+        for (auto op : ops(i))
+            use_list_[pos[op]++] = i;
+    }
+}
 
-    if (auto param = def->isa<Param>())
-        return def2early_[def] = cfg_[param->continuation()];
+void Scheduler::topo_sort() {
+    // Kahn's algorithm: a def becomes ready as soon as all its operands have been emitted
+    std::vector<size_t> num_pending(num_defs());
+    topo_.reserve(num_defs());
+    for (size_t i = 0, e = num_defs(); i != e; ++i) {
+        num_pending[i] = ops(i).size();
+        if (num_pending[i] == 0)
+            topo_.push_back(i);
+    }
 
-    auto result = cfg_.entry();
-    for (auto op : def->as<PrimOp>()->ops()) {
-        if (!op->isa_continuation() && def2uses_.find(op) != def2uses_.end()) {
-            auto n = schedule_early(op);
-            if (domtree_.depth(n) > domtree_.depth(result))
-                result = n;
+    // topo_ doubles as the queue
+    for (size_t t = 0; t != topo_.size(); ++t) {
+        for (auto use : uses(topo_[t])) {
+            if (--num_pending[use] == 0)
+                topo_.push_back(use);
         }
     }
 
-    return def2early_[def] = result;
+    assert(topo_.size() == num_defs() && "cycle among primops");
 }
 
-const CFNode* Scheduler::schedule_late(const Def* def) {
-    auto i = def2late_.find(def);
-    if (i != def2late_.end())
-        return i->second;
-
-    if (auto continuation = def->isa_continuation())
-        return def2late_[def] = cfg_[continuation];
-
-    const CFNode* result = nullptr;
-    auto primop = def->as<PrimOp>();
-    for (auto use : uses(primop)) {
-        auto n = schedule_late(use);
-        result = result ? domtree_.lca(result, n) : n;
+void Scheduler::schedule_early() {
+    early_.assign(num_defs(), nullptr);
+    for (auto i : topo_) {
+        auto def = defs_[i];
+        if (i < num_continuations_) {
+            early_[i] = cfg_.reverse_post_order()[i];
+        } else if (auto param = def->isa<Param>()) {
+            early_[i] = cfg_[param->continuation()];
+        } else {
+            auto result = cfg_.entry();
+            for (auto op : ops(i)) {
+                auto n = early_[op];
+                if (domtree_.depth(n) > domtree_.depth(result))
+                    result = n;
+            }
+            early_[i] = result;
+        }
     }
+    result_ = early_;
+}
 
-    return def2late_[def] = result;
+void Scheduler::schedule_late() {
+    late_.assign(num_defs(), nullptr);
+    for (auto t = topo_.rbegin(), e = topo_.rend(); t != e; ++t) {
+        auto i = *t;
+        if (i < num_continuations_) {
+            late_[i] = cfg_.reverse_post_order()[i];
+        } else {
+            const CFNode* result = nullptr;
+            for (auto use : uses(i))
+                result = lca(result, late_[use]);
+            late_[i] = result;
+        }
+    }
+    result_ = late_;
 }
 
-const CFNode* Scheduler::schedule_smart(const PrimOp* primop) {
-    auto i = def2smart_.find(primop);
-    if (i != def2smart_.end())
-        return i->second;
+void Scheduler::schedule_smart() {
+    for (size_t i = num_continuations_, e = num_defs(); i != e; ++i) {
+        if (auto primop = defs_[i]->isa<PrimOp>())
+            result_[i] = shallowest_loop(primop, early_[i], late_[i]);
+    }
+}
 
-    auto early = schedule_early(primop);
-    auto late  = schedule_late (primop);
+/// Ops that are at most as expensive as keeping their result alive in a register.
+static bool is_cheap(const PrimOp* primop) {
+    if (primop->isa<LEA>() || primop->isa<ConvOp>() || primop->isa<Literal>())
+        return true;
+    if (auto extract = primop->isa<Extract>())
+        return !extract->agg()->isa<MemOp>() && extract->index()->isa<PrimLit>();
+    return false;
+}
 
-    const CFNode* result;
-    result = late;
-    int depth = looptree_[late]->depth();
-    for (auto i = late; i != early;) {
-        auto idom = domtree_.idom(i);
-        assert(i != idom);
-        i = idom;
-
-        // HACK this should actually never occur
-        if (i == nullptr) {
-            WLOG("don't know where to put {}", primop);
-            result = late;
-            break;
+void Scheduler::schedule_remat() {
+    for (auto t = topo_.rbegin(), e = topo_.rend(); t != e; ++t) {
+        auto i = *t;
+        if (auto primop = defs_[i]->isa<PrimOp>()) {
+            if (!is_cheap(primop)) {
+                result_[i] = shallowest_loop(primop, early_[i], late_[i]);
+            } else {
+                // Hoisting a cheap op out of a loop only stretches its live range across the loop.
+                // Place it right at the common dominator of the final positions of its users instead.
+                const CFNode* result = nullptr;
+                for (auto use : uses(i))
+                    result = lca(result, result_[use]);
+                result_[i] = result;
+            }
         }
+    }
+}
 
+const CFNode* Scheduler::shallowest_loop(const PrimOp* primop, const CFNode* early, const CFNode* late) {
+    // Walk up the dominator tree from late to early and take the first node with the smallest loop depth.
+    // early dominates late in a well-formed scope, so there is no need to climb higher than early.
+    const CFNode* result = late;
+    int depth = looptree_[late]->depth();
+    auto i = late;
+    for (int early_depth = domtree_.depth(early); domtree_.depth(i) > early_depth;) {
+        i = domtree_.idom(i);
         int cur_depth = looptree_[i]->depth();
         if (cur_depth < depth) {
             result = i;
@@ -170,50 +220,12 @@ const CFNode* Scheduler::schedule_smart(const PrimOp* primop) {
         }
     }
 
-    return def2smart_[primop] = result;
-}
-
-void Scheduler::topo_sort(Def2CFNode& def2node) {
-    for (auto& block : schedule_.blocks_) {
-        std::vector<const PrimOp*> primops;
-        std::queue<const PrimOp*> queue;
-        DefSet done;
-
-        auto inside = [&](const Def* def) {
-            auto i = def2node.find(def);
-            return i != def2node.end() && i->second == block.node();
-        };
-
-        auto enqueue = [&](const PrimOp* primop) {
-            if (!done.contains(primop)) {
-                for (auto op : primop->ops()) {
-                    if (inside(op) && !done.contains(op))
-                        return;
-                }
-
-                queue.push(primop);
-                done.emplace(primop);
-                primops.push_back(primop);
-            }
-        };
-
-        for (auto primop : block)
-            enqueue(primop);
-
-        while (!queue.empty()) {
-            auto primop = pop(queue);
-
-            for (auto use : uses(primop)) {
-                if (auto primop = use->isa<PrimOp>()) {
-                    if (inside(primop))
-                        enqueue(primop);
-                }
-            }
-        }
-
-        assert(block.primops_.size() == primops.size());
-        swap(block.primops_, primops);
+    if (i != early) {
+        WLOG("{} is used outside of the blocks dominated by its operands", primop);
+        return late;
     }
+
+    return result;
 }
 
 //------------------------------------------------------------------------------
@@ -241,6 +253,19 @@ void Schedule::block_schedule() {
     assert(blocks_.size() == i);
 }
 
+#if THORIN_ENABLE_CHECKS
+/// Is @p def the memory output of @p mem, or @p mem itself if it is a memory param?
+static bool is_mem_out(const Def* def, const Def* mem) {
+    if (auto memop = mem->isa<MemOp>()) {
+        if (memop->has_multiple_outs()) {
+            auto extract = def->isa<Extract>();
+            return extract && extract->agg() == memop && is_primlit(extract->index(), 0);
+        }
+    }
+    return def == mem;
+}
+#endif
+
 void Schedule::verify() {
 #if THORIN_ENABLE_CHECKS
     bool ok = true;
@@ -253,11 +278,12 @@ void Schedule::verify() {
         mem = mem ? mem : block2mem[(*this)[idom]];
         for (auto primop : block) {
             if (auto memop = primop->isa<MemOp>()) {
-                if (memop->mem() != mem) {
+                if (!is_mem_out(memop->mem(), mem)) {
                     WLOG("incorrect schedule: {} @ '{}'; current mem is {} @ '{}') - scope entry: {}", memop, memop->location(), mem, mem->location(), scope_.entry());
                     ok = false;
                 }
-                mem = memop->out_mem();
+                // don't use out_mem here as it creates a new extract if there is none, and schedules are built concurrently
+                mem = memop;
             }
         }
         block2mem[block] = mem;
@@ -10,7 +10,11 @@ class PrimOp;
 
 class Schedule : public Streamable {
 public:
-    enum Tag { Early, Late, Smart };
+    /**
+     * @p Smart hoists each @p PrimOp to the shallowest loop between its early and late position.
+     * @p Remat does the same but keeps cheap ops (@p LEA%s, casts, extracts) next to their users to shorten live ranges.
+     */
+    enum Tag { Early, Late, Smart, Remat };
 
     class Block {
     public:
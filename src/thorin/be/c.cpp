@@ -4,15 +4,23 @@
 #include "thorin/world.h"
 #include "thorin/analyses/cfg.h"
 #include "thorin/analyses/domtree.h"
+#include "thorin/analyses/looptree.h"
 #include "thorin/analyses/schedule.h"
 #include "thorin/analyses/scope.h"
 #include "thorin/util/log.h"
 #include "thorin/util/stream.h"
 #include "thorin/be/c.h"
+#include "thorin/be/hls_dataflow.h"
+#include "thorin/be/loop_pipelining.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <mutex>
 #include <sstream>
+#include <thread>
 #include <type_traits>
+#include <unordered_set>
 #include <cctype>
 
 namespace thorin {
@@ -28,18 +36,52 @@ public:
         , os_(stream)
     {}
 
-    void emit();
+    void emit(unsigned num_threads);
     void emit_c_int();
     World& world() const { return world_; }
 
 private:
+    /// Code generator for a single function; shares the globals of @p parent.
+    explicit CCodeGen(CCodeGen* parent)
+        : world_(parent->world_)
+        , kernel_config_(parent->kernel_config_)
+        , lang_(parent->lang_)
+        , fn_mem_(parent->fn_mem_)
+        , debug_(parent->debug_)
+        , os_(parent->os_)
+        , parent_(parent)
+    {}
+
+    /// Statement that encloses the code emitted for a basic block.
+    struct Enclosing {
+        enum Tag { If, Switch, Loop, For, Seq } tag;
+        Continuation* continuation; ///< Loop header, continue of a pipelined loop, or block following a @p Seq.
+    };
+
+    /// How a jump to a basic block is emitted.
+    enum class Transfer { Inline, Fall, Break, Continue, Goto };
+
+    void emit_function(Continuation*);
+    void plan_block(Continuation*);
+    void emit_block(Continuation*);
+    void emit_jump(Continuation*, Continuation*);
+    template<class F> void for_each_jump(Continuation*, F);
+    Transfer transfer(Continuation*, Continuation*);
+    bool is_loop_header(Continuation*);
+    bool is_back_edge(Continuation*, Continuation*);
+    std::vector<Continuation*> merge_blocks(Continuation*);
+    std::ostream& var_decl();
+    void coalesce_params();
+    std::string phi_name(const Param*);
     std::ostream& emit_aggop_defs(const Def*);
-    std::ostream& emit_aggop_decl(const Type*);
+    void emit_aggop_decl(const Type*);
+    void emit_type_decl(const Type*);
     std::ostream& emit_debug_info(const Def*);
     std::ostream& emit_addr_space(std::ostream&, const Type*);
-    std::ostream& emit_string(const Global*);
+    void emit_string(const Global*);
     std::ostream& emit_temporaries(const Def*);
     std::ostream& emit_type(std::ostream&, const Type*);
+    std::ostream& emit_component(size_t);
     std::ostream& emit(const Def*);
 
     template <typename T, typename IsInfFn, typename IsNanFn>
@@ -50,15 +92,18 @@ private:
     bool lookup(const Def*);
     void insert(const Type*, std::string);
     void insert(const Def*, std::string);
-    std::string& get_name(const Type*);
-    std::string& get_name(const Def*);
-    const std::string var_name(const Def*);
+    const std::string& get_name(const Type*);
+    const std::string& get_name(const Def*);
+    const std::string* find_name(const Def*);
+    std::string var_name(const Def*);
     const std::string get_lang() const;
     bool is_texture_type(const Type*);
 
     std::string type_name(const Type*);
     std::string array_name(const DefiniteArrayType*);
     std::string tuple_name(const TupleType*);
+    std::string vector_name(const PrimType*);
+    const Type* tuple_type(ArrayRef<const Type*>);
 
     World& world_;
     const Cont2Config& kernel_config_;
@@ -74,17 +119,45 @@ private:
     bool debug_;
     int primop_counter = 0;
     std::ostream& os_;
-    std::ostringstream func_impl_;
-    std::ostringstream func_decls_;
-    std::ostringstream type_decls_;
+    CCodeGen* parent_ = nullptr;
+    std::mutex world_mutex_;
+    const Scope* scope_ = nullptr;
+    const Schedule* schedule_ = nullptr;
+    const Param* ret_param_ = nullptr;
+    std::vector<Enclosing> enclosing_;
+    ContinuationMap<size_t> jumps_;
+    ContinuationSet labels_;
+    ParamSet direct_;                   ///< Params assigned without phi variable.
+    ParamMap<const PrimOp*> coalesced_; ///< Params that share the variable of their argument.
+    size_t num_coalesced_ = 0;
+    std::unique_ptr<HLSDataflow> dataflow_;
+    std::unique_ptr<LoopPipelining> pipelining_;
+    ChunkStream func_head_;
+    ChunkStream func_impl_;
+    ChunkStream func_decls_;
+    std::vector<std::pair<const Type*, std::string>> type_decls_; ///< Texture declarations have no type.
 };
 
 std::ostream& CCodeGen::emit_debug_info(const Def* def) {
     if (debug_ && def->location().filename())
-        return streamf(func_impl_, "#line {} \"{}\"", def->location().front_line(), def->location().filename()) << endl;
+        return streamf(func_impl_ << endl, "#line {} \"{}\"", def->location().front_line(), def->location().filename());
     return func_impl_;
 }
 
+std::ostream& CCodeGen::var_decl() {
+    // basic blocks are nested in structured control flow, so all variables are declared at the beginning of the function
+    if (!scope_)
+        return func_impl_; // initializers of globals
+    // the declaration is indented one level, whatever the nesting of the block that is being emitted
+    auto nesting = detail::get_indent();
+    for (auto i = nesting; i > 1; --i)
+        func_head_ << down;
+    func_head_ << endl;
+    for (auto i = nesting; i > 1; --i)
+        func_head_ << up;
+    return func_head_;
+}
+
 std::ostream& CCodeGen::emit_addr_space(std::ostream& os, const Type* type) {
     if (auto ptr = type->isa<PtrType>()) {
         if (lang_==Lang::OPENCL) {
@@ -121,7 +194,7 @@ std::string handle_string_character(char c) {
     }
 }
 
-std::ostream& CCodeGen::emit_string(const Global* global) {
+void CCodeGen::emit_string(const Global* global) {
     if (auto str_array = global->init()->isa<DefiniteArray>()) {
         if (str_array->ops().back()->as<PrimLit>()->pu8_value() == pu8(0)) {
             if (auto primtype = str_array->elem_type()->isa<PrimType>()) {
@@ -135,8 +208,6 @@ std::ostream& CCodeGen::emit_string(const Global* global) {
             }
         }
     }
-
-    return type_decls_;
 }
 
 std::ostream& CCodeGen::emit_type(std::ostream& os, const Type* type) {
@@ -209,6 +280,8 @@ std::ostream& CCodeGen::emit_type(std::ostream& os, const Type* type) {
             os << vector_length(ptr->pointee());
         return os;
     } else if (auto primtype = type->isa<PrimType>()) {
+        if (primtype->is_vector())
+            return os << vector_name(primtype);
         switch (primtype->primtype_tag()) {
             case PrimType_bool:                     os << "bool";                   break;
             case PrimType_ps8:  case PrimType_qs8:  os << "char";                   break;
@@ -223,13 +296,24 @@ std::ostream& CCodeGen::emit_type(std::ostream& os, const Type* type) {
             case PrimType_pf32: case PrimType_qf32: os << "float";                  break;
             case PrimType_pf64: case PrimType_qf64: os << "double"; use_64_ = true; break;
         }
-        if (primtype->is_vector())
-            os << primtype->length();
         return os;
     }
     THORIN_UNREACHABLE;
 }
 
+/// Vectors of bools are represented as integer masks.
+static const Type* vector_elem_type(const PrimType* primtype) {
+    return primtype->primtype_tag() == PrimType_bool ? primtype->table().type_ps32() : primtype->scalarize();
+}
+
+std::ostream& CCodeGen::emit_component(size_t i) {
+    switch (lang_) {
+        case Lang::CUDA:   assert(i < 4);  return func_impl_ << "." << "xyzw"[i];
+        case Lang::OPENCL: assert(i < 16); return func_impl_ << ".s" << "0123456789abcdef"[i];
+        default:           return func_impl_ << "[" << i << "]";
+    }
+}
+
 std::ostream& CCodeGen::emit_aggop_defs(const Def* def) {
     if (lookup(def) || is_unit(def))
         return func_impl_;
@@ -240,7 +324,7 @@ std::ostream& CCodeGen::emit_aggop_defs(const Def* def) {
             emit_aggop_defs(op);
         if (lookup(def))
             return func_impl_;
-        emit(array) << endl;
+        emit(array);
     }
 
     // look for nested struct
@@ -249,7 +333,7 @@ std::ostream& CCodeGen::emit_aggop_defs(const Def* def) {
             emit_aggop_defs(op);
         if (lookup(def))
             return func_impl_;
-        emit(agg) << endl;
+        emit(agg);
     }
 
     // look for nested variants
@@ -258,24 +342,24 @@ std::ostream& CCodeGen::emit_aggop_defs(const Def* def) {
             emit_aggop_defs(op);
         if (lookup(def))
             return func_impl_;
-        emit(variant) << endl;
+        emit(variant);
     }
 
     // emit declarations for bottom - required for nested data structures
     if (def->isa<Bottom>())
-        emit(def) << endl;
+        emit(def);
 
     return func_impl_;
 }
 
-std::ostream& CCodeGen::emit_aggop_decl(const Type* type) {
+void CCodeGen::emit_aggop_decl(const Type* type) {
     if (lookup(type) || type == world().unit())
-        return type_decls_;
+        return;
 
     // set indent to zero
     auto indent = detail::get_indent();
     while (detail::get_indent() != 0)
-        type_decls_ << down;
+        detail::dec_indent();
 
     if (auto ptr = type->isa<PtrType>())
         emit_aggop_decl(ptr->pointee());
@@ -287,10 +371,24 @@ std::ostream& CCodeGen::emit_aggop_decl(const Type* type) {
         for (auto type : fn->ops())
             emit_aggop_decl(type);
 
+    // C99 and HLS declare vectors with the vector extension of the compiler; OpenCL and CUDA have built-in vector types
+    if (auto primtype = type->isa<PrimType>()) {
+        if (primtype->is_vector() && (lang_ == Lang::C99 || lang_ == Lang::HLS)) {
+            auto elem_type = vector_elem_type(primtype);
+            auto name = vector_name(primtype);
+            std::ostringstream os;
+            os << "typedef ";
+            emit_type(os, elem_type) << " " << name << " __attribute__((vector_size("
+                << num_bits(elem_type->as<PrimType>()->primtype_tag()) / 8 * primtype->length() << ")));" << endl;
+            type_decls_.emplace_back(type, os.str());
+            insert(type, name);
+        }
+    }
+
     // look for nested array
     if (auto array = type->isa<DefiniteArrayType>()) {
         emit_aggop_decl(array->elem_type());
-        emit_type(type_decls_, array) << endl;
+        emit_type_decl(array);
         insert(type, array_name(array));
     }
 
@@ -298,7 +396,7 @@ std::ostream& CCodeGen::emit_aggop_decl(const Type* type) {
     if (auto tuple = type->isa<TupleType>()) {
         for (auto op : tuple->ops())
             emit_aggop_decl(op);
-        emit_type(type_decls_, tuple) << endl;
+        emit_type_decl(tuple);
         insert(type, tuple_name(tuple));
     }
 
@@ -306,7 +404,7 @@ std::ostream& CCodeGen::emit_aggop_decl(const Type* type) {
     if (auto struct_type = type->isa<StructType>()) {
         for (auto op : struct_type->ops())
             emit_aggop_decl(op);
-        emit_type(type_decls_, struct_type) << endl;
+        emit_type_decl(struct_type);
         insert(type, struct_type->name().str());
     }
 
@@ -314,15 +412,19 @@ std::ostream& CCodeGen::emit_aggop_decl(const Type* type) {
     if (auto variant = type->isa<VariantType>()) {
         for (auto op : variant->ops())
             emit_aggop_decl(op);
-        emit_type(type_decls_, variant) << endl;
+        emit_type_decl(variant);
         insert(type, variant->name().str());
     }
 
     // restore indent
     while (detail::get_indent() != indent)
-        type_decls_ << up;
+        detail::inc_indent();
+}
 
-    return type_decls_;
+void CCodeGen::emit_type_decl(const Type* type) {
+    std::ostringstream os;
+    emit_type(os, type) << endl;
+    type_decls_.emplace_back(type, os.str());
 }
 
 std::ostream& CCodeGen::emit_temporaries(const Def* def) {
@@ -334,10 +436,31 @@ std::ostream& CCodeGen::emit_temporaries(const Def* def) {
     if (def->order() >= 1 || is_mem(def) || is_unit(def) || lookup(def) || def->isa<PrimLit>())
         return func_impl_;
 
-    return emit(def) << endl;
+    return emit(def);
 }
 
-void CCodeGen::emit() {
+/// Function generators enclose the suffixes of constant names in this mark until they are numbered in file order.
+static const char counter_mark = '\x1f';
+
+/// Writes @p stream to @p os and numbers the marked suffixes from @p base on.
+static void write_numbered(const ChunkStream& stream, std::ostream& os, int base) {
+    std::ostringstream text;
+    stream.write_to(text);
+    auto str = text.str();
+    for (size_t i = 0, e = str.size(); i != e;) {
+        auto begin = str.find(counter_mark, i);
+        if (begin == std::string::npos) {
+            os.write(str.data() + i, e - i);
+            break;
+        }
+        auto end = str.find(counter_mark, begin + 1);
+        os.write(str.data() + i, begin - i);
+        os << base + std::stoi(str.substr(begin + 1, end - begin - 1));
+        i = end + 1;
+    }
+}
+
+void CCodeGen::emit(unsigned num_threads) {
     if (lang_==Lang::CUDA) {
         func_decls_ << "__device__ inline int threadIdx_x() { return threadIdx.x; }" << endl;
         func_decls_ << "__device__ inline int threadIdx_y() { return threadIdx.y; }" << endl;
@@ -365,469 +488,825 @@ void CCodeGen::emit() {
         }
     }
 
+    // each function is emitted by its own code generator; the results are stitched together in the original order
+    std::vector<Continuation*> continuations;
     Scope::for_each(world(), [&] (const Scope& scope) {
-        if (scope.entry() == world().branch())
-            return;
+        if (scope.entry() != world().branch() && !scope.entry()->is_intrinsic())
+            continuations.push_back(scope.entry());
+    });
 
-        // continuation declarations
-        auto continuation = scope.entry();
-        if (continuation->is_intrinsic())
-            return;
+    std::vector<std::unique_ptr<CCodeGen>> functions(continuations.size());
+    std::atomic<size_t> next(0);
+    auto work = [&] {
+        for (size_t i; (i = next++) < continuations.size();) {
+            functions[i].reset(new CCodeGen(this));
+            functions[i]->emit_function(continuations[i]);
+        }
+    };
 
-        assert(continuation->is_returning());
+    if (num_threads == 0)
+        num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<std::thread> workers;
+    for (size_t i = 1, e = std::min(size_t(num_threads), continuations.size()); i < e; ++i)
+        workers.emplace_back(work);
+    work();
+    for (auto& worker : workers)
+        worker.join();
+
+    // keep the first of identical declarations - different vector types may share the same native vector type
+    std::unordered_set<std::string> declared;
+    auto main_decls = std::move(type_decls_);
+    type_decls_.clear();
+    for (auto& decl : main_decls) {
+        if (declared.insert(decl.second).second)
+            type_decls_.push_back(std::move(decl));
+    }
+    for (size_t i = 0, e = functions.size(); i != e; ++i) {
+        auto& function = functions[i];
+        VLOG("{}: coalesced {} phi copies", continuations[i], function->num_coalesced_);
+        for (auto& decl : function->type_decls_) {
+            if (declared.insert(decl.second).second)
+                type_decls_.push_back(std::move(decl));
+        }
+        use_64_       |= function->use_64_;
+        use_16_       |= function->use_16_;
+        use_channels_ |= function->use_channels_;
+    }
 
-        // retrieve return param
-        const Param* ret_param = nullptr;
-        for (auto param : continuation->params()) {
-            if (param->order() != 0) {
-                assert(!ret_param);
-                ret_param = param;
-            }
+    type2str_.clear();
+    global2str_.clear();
+
+    if (lang_==Lang::OPENCL) {
+        if (use_channels_)
+            os_ << "#pragma OPENCL EXTENSION cl_intel_channels : enable" << endl;
+        if (use_16_)
+            os_ << "#pragma OPENCL EXTENSION cl_khr_fp16 : enable" << endl;
+        if (use_64_)
+            os_ << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable" << endl;
+        if (use_channels_ || use_16_ || use_64_)
+            os_ << endl;
+    }
+
+    if (lang_==Lang::CUDA && use_16_) {
+        os_ << "#include <cuda_fp16.h>" << endl << endl;
+        os_ << "#if __CUDACC_VER_MAJOR__ > 8" << endl
+            << "#define half __half_raw" << endl
+            << "#endif" << endl << endl;
+    }
+
+    if (lang_==Lang::CUDA || lang_==Lang::HLS)
+        os_ << "extern \"C\" {" << endl;
+
+    if (!type_decls_.empty()) {
+        for (auto& decl : type_decls_)
+            os_ << decl.second;
+        os_ << endl;
+    }
+    bool decls = !func_decls_.empty() || !functions.empty();
+    func_decls_.write_to(os_);
+    for (auto& function : functions)
+        function->func_decls_.write_to(os_);
+    if (decls)
+        os_ << endl;
+    func_impl_.write_to(os_);
+    // constant names are numbered across the whole file as if one generator emitted all functions
+    for (auto& function : functions) {
+        if (function->primop_counter == 0) {
+            function->func_head_.write_to(os_);
+            function->func_impl_.write_to(os_);
+        } else {
+            write_numbered(function->func_head_, os_, primop_counter);
+            write_numbered(function->func_impl_, os_, primop_counter);
+            primop_counter += function->primop_counter;
         }
-        assert(ret_param);
+    }
 
-        // emit function & its declaration
-        auto ret_param_fn_type = ret_param->type()->as<FnType>();
-        auto ret_type = ret_param_fn_type->num_ops() > 2 ? world_.tuple_type(ret_param_fn_type->ops().skip_front()) : ret_param_fn_type->ops().back();
-        auto name = (continuation->is_exported() || continuation->empty()) ? continuation->name() : continuation->unique_name();
-        if (continuation->is_exported()) {
-            auto config = kernel_config_.find(continuation);
-            switch (lang_) {
-                default: break;
-                case Lang::CUDA:
-                   func_decls_ << "__global__ ";
-                   func_impl_  << "__global__ ";
-                   if (config != kernel_config_.end()) {
-                       auto block = config->second->as<GPUKernelConfig>()->block_size();
-                       if (std::get<0>(block) > 0 && std::get<1>(block) > 0 && std::get<2>(block) > 0)
-                           func_impl_ << "__launch_bounds__ (" << std::get<0>(block) << " * " << std::get<1>(block) << " * " << std::get<2>(block) << ") ";
-                   }
-                   break;
-                case Lang::OPENCL:
-                   func_decls_ << "__kernel ";
-                   func_impl_  << "__kernel ";
-                   if (config != kernel_config_.end()) {
-                       auto block = config->second->as<GPUKernelConfig>()->block_size();
-                       if (std::get<0>(block) > 0 && std::get<1>(block) > 0 && std::get<2>(block) > 0)
-                           func_impl_ << "__attribute__((reqd_work_group_size(" << std::get<0>(block) << ", " << std::get<1>(block) << ", " << std::get<2>(block) << "))) ";
-                   }
-                   break;
+    if (lang_==Lang::CUDA || lang_==Lang::HLS)
+        os_ << "}"; // extern "C"
+}
+
+void CCodeGen::emit_function(Continuation* continuation) {
+    Scope scope(continuation);
+    assert(continuation->is_returning());
+
+    // retrieve return param
+    const Param* ret_param = nullptr;
+    for (auto param : continuation->params()) {
+        if (param->order() != 0) {
+            assert(!ret_param);
+            ret_param = param;
+        }
+    }
+    assert(ret_param);
+
+    // emit function & its declaration
+    auto ret_param_fn_type = ret_param->type()->as<FnType>();
+    auto ret_type = ret_param_fn_type->num_ops() > 2 ? tuple_type(ret_param_fn_type->ops().skip_front()) : ret_param_fn_type->ops().back();
+    auto name = (continuation->is_exported() || continuation->empty()) ? continuation->name() : continuation->unique_name();
+    if (continuation->is_exported()) {
+        auto config = kernel_config_.find(continuation);
+        switch (lang_) {
+            default: break;
+            case Lang::CUDA:
+               func_decls_ << "__global__ ";
+               func_head_  << "__global__ ";
+               if (config != kernel_config_.end()) {
+                   auto block = config->second->as<GPUKernelConfig>()->block_size();
+                   if (std::get<0>(block) > 0 && std::get<1>(block) > 0 && std::get<2>(block) > 0)
+                       func_head_ << "__launch_bounds__ (" << std::get<0>(block) << " * " << std::get<1>(block) << " * " << std::get<2>(block) << ") ";
+               }
+               break;
+            case Lang::OPENCL:
+               func_decls_ << "__kernel ";
+               func_head_  << "__kernel ";
+               if (config != kernel_config_.end()) {
+                   auto block = config->second->as<GPUKernelConfig>()->block_size();
+                   if (std::get<0>(block) > 0 && std::get<1>(block) > 0 && std::get<2>(block) > 0)
+                       func_head_ << "__attribute__((reqd_work_group_size(" << std::get<0>(block) << ", " << std::get<1>(block) << ", " << std::get<2>(block) << "))) ";
+               }
+               break;
+        }
+    } else {
+        if (lang_==Lang::CUDA) {
+            func_decls_ << "__device__ ";
+            func_head_  << "__device__ ";
+        }
+    }
+    emit_aggop_decl(ret_type);
+    emit_addr_space(func_decls_, ret_type);
+    emit_addr_space(func_head_,  ret_type);
+    emit_type(func_decls_, ret_type) << " " << name << "(";
+    emit_type(func_head_,  ret_type) << " " << name << "(";
+    size_t i = 0;
+    std::string hls_pragmas;
+    if (lang_ == Lang::HLS && continuation->is_exported())
+        dataflow_ = std::make_unique<HLSDataflow>(scope);
+    // emit and store all first-order params
+    for (auto param : continuation->params()) {
+        if (is_mem(param) || is_unit(param))
+            continue;
+        if (param->order() == 0) {
+            emit_aggop_decl(param->type());
+            if (is_texture_type(param->type())) {
+                // emit texture declaration for CUDA
+                std::ostringstream os;
+                os << "texture<";
+                emit_type(os, param->type()->as<PtrType>()->pointee());
+                os << ", cudaTextureType1D, cudaReadModeElementType> ";
+                os << param->name() << ";" << endl;
+                type_decls_.emplace_back(nullptr, os.str());
+                insert(param, param->name().str());
+                // skip arrays bound to texture memory
+                continue;
             }
-        } else {
-            if (lang_==Lang::CUDA) {
-                func_decls_ << "__device__ ";
-                func_impl_  << "__device__ ";
+            if (i++ > 0) {
+                func_decls_ << ", ";
+                func_head_  << ", ";
             }
+
+            // get the kernel launch config
+            KernelConfig* config = nullptr;
+            if (continuation->is_exported()) {
+                auto config_it = kernel_config_.find(continuation);
+                assert(config_it != kernel_config_.end());
+                config = config_it->second.get();
+            }
+
+            if (lang_ == Lang::OPENCL && continuation->is_exported() &&
+                (param->type()->isa<DefiniteArrayType>() ||
+                 param->type()->isa<StructType>() ||
+                 param->type()->isa<TupleType>())) {
+                // structs are passed via buffer; the parameter is a pointer to this buffer
+                func_decls_ << "__global ";
+                func_head_  << "__global ";
+                emit_type(func_decls_, param->type()) << " *";
+                emit_type(func_head_,  param->type()) << " *" << param->unique_name() << "_";
+            } else if (lang_ == Lang::HLS && continuation->is_exported() && param->type()->isa<PtrType>()) {
+                auto array_size = config->as<HLSKernelConfig>()->param_size(param);
+                assert(array_size > 0);
+                auto ptr_type = param->type()->as<PtrType>();
+                auto elem_type = ptr_type->pointee();
+                if (auto array_type = elem_type->isa<ArrayType>())
+                    elem_type = array_type->elem_type();
+                emit_type(func_decls_, elem_type) << "[" << array_size << "]";
+                emit_type(func_head_,  elem_type) << " " << param->unique_name() << "[" << array_size << "]";
+                if (elem_type->isa<StructType>() || elem_type->isa<DefiniteArrayType>())
+                    hls_pragmas += "#pragma HLS data_pack variable=" + param->unique_name() + " struct_level\n";
+                if (dataflow_->is_stream(param))
+                    hls_pragmas += "#pragma HLS INTERFACE axis port=" + param->unique_name() + "\n";
+            } else {
+                std::string qualifier;
+                // add restrict qualifier when possible
+                if ((lang_ == Lang::OPENCL || lang_ == Lang::CUDA) &&
+                    config && param->type()->isa<PtrType>() &&
+                    config->as<GPUKernelConfig>()->has_restrict(param)) {
+                    qualifier = lang_ == Lang::CUDA ? " __restrict" : " restrict";
+                }
+                emit_addr_space(func_decls_, param->type());
+                emit_addr_space(func_head_,  param->type());
+                emit_type(func_decls_, param->type()) << qualifier;
+                emit_type(func_head_,  param->type()) << qualifier << " " << param->unique_name();
+            }
+            insert(param, param->unique_name());
         }
-        emit_aggop_decl(ret_type);
-        emit_addr_space(func_decls_, ret_type);
-        emit_addr_space(func_impl_,  ret_type);
-        emit_type(func_decls_, ret_type) << " " << name << "(";
-        emit_type(func_impl_,  ret_type) << " " << name << "(";
-        size_t i = 0;
-        std::string hls_pragmas;
-        // emit and store all first-order params
-        for (auto param : continuation->params()) {
+    }
+    func_decls_ << ");" << endl;
+    func_head_  << ") {" << up;
+    if (dataflow_ && !dataflow_->empty()) {
+        // the pipelines run as concurrent processes connected by the streamed buffers
+        hls_pragmas += "#pragma HLS dataflow\n";
+        auto interval = dataflow_->interval();
+        VLOG("{}: {} dataflow stages, interval of {} cycles instead of {}", continuation, dataflow_->stages().size(), interval.first, interval.second);
+    }
+    if (!hls_pragmas.empty())
+        func_head_ << down << endl << hls_pragmas << up;
+
+    // OpenCL: load struct from buffer
+    for (auto param : continuation->params()) {
+        if (is_mem(param) || is_unit(param))
+            continue;
+        if (param->order() == 0) {
+            if (lang_==Lang::OPENCL && continuation->is_exported() &&
+                (param->type()->isa<DefiniteArrayType>() ||
+                 param->type()->isa<StructType>() ||
+                 param->type()->isa<TupleType>())) {
+                func_head_ << endl;
+                emit_type(func_head_, param->type()) << " " << param->unique_name() << " = *" << param->unique_name() << "_;";
+            }
+        }
+    }
+
+    Schedule schedule(scope);
+    scope_ = &scope;
+    schedule_ = &schedule;
+    ret_param_ = ret_param;
+    coalesce_params();
+    // OpenCL kernels may run on GPUs: only the explicit pipeline intrinsic pipelines their loops
+    if (lang_ == Lang::HLS) {
+        pipelining_ = std::make_unique<LoopPipelining>(scope, schedule);
+        for (const auto& loop : pipelining_->loops()) {
+            if (loop.ii != 0)
+                VLOG("{}: pipelining loop {} with II={}", continuation, loop.header, loop.ii);
+            else
+                VLOG("{}: not pipelining loop {}: {}", continuation, loop.header, loop.reason);
+        }
+    }
+
+    // emit function arguments and phi nodes
+    for (const auto& block : schedule) {
+        for (auto param : block.continuation()->params()) {
             if (is_mem(param) || is_unit(param))
                 continue;
-            if (param->order() == 0) {
-                emit_aggop_decl(param->type());
-                if (is_texture_type(param->type())) {
-                    // emit texture declaration for CUDA
-                    type_decls_ << "texture<";
-                    emit_type(type_decls_, param->type()->as<PtrType>()->pointee());
-                    type_decls_ << ", cudaTextureType1D, cudaReadModeElementType> ";
-                    type_decls_ << param->name() << ";" << endl;
-                    insert(param, param->name().str());
-                    // skip arrays bound to texture memory
+            emit_aggop_decl(param->type());
+            auto arg = coalesced_.find(param);
+            insert(param, arg != coalesced_.end() ? arg->second->unique_name() : param->unique_name());
+        }
+
+        auto continuation = block.continuation();
+        if (scope.entry() != continuation) {
+            for (auto param : continuation->params()) {
+                if (is_mem(param) || is_unit(param))
                     continue;
+                // coalesced params live in the variable of their argument
+                if (!coalesced_.contains(param)) {
+                    func_head_ << endl;
+                    emit_addr_space(func_head_, param->type());
+                    emit_type(func_head_, param->type()) << "  " << param->unique_name() << ";";
                 }
-                if (i++ > 0) {
-                    func_decls_ << ", ";
-                    func_impl_  << ", ";
+                if (!direct_.contains(param)) {
+                    func_head_ << endl;
+                    emit_addr_space(func_head_, param->type());
+                    emit_type(func_head_, param->type()) << " p" << param->unique_name() << ";";
                 }
+            }
+        }
+        // emit counter for pipeline intrinsic
+        if (!continuation->empty() && continuation->callee()->isa_continuation() &&
+            continuation->callee()->as_continuation()->intrinsic() == Intrinsic::Pipeline) {
+            func_head_ << endl << "int i" << continuation->callee()->gid() << ";";
+        }
+    }
 
-                // get the kernel launch config
-                KernelConfig* config = nullptr;
-                if (continuation->is_exported()) {
-                    auto config_it = kernel_config_.find(continuation);
-                    assert(config_it != kernel_config_.end());
-                    config = config_it->second.get();
-                }
+    // count the jumps to each basic block that do not close a loop - blocks with a single one are emitted in place
+    for (const auto& block : schedule) {
+        auto continuation = block.continuation();
+        if (continuation->empty())
+            continue;
+        for_each_jump(continuation, [&] (const Enclosing*, Continuation* succ) {
+            if (!succ->empty() && !is_back_edge(continuation, succ))
+                ++jumps_[succ];
+        });
+    }
 
-                if (lang_ == Lang::OPENCL && continuation->is_exported() &&
-                    (param->type()->isa<DefiniteArrayType>() ||
-                     param->type()->isa<StructType>() ||
-                     param->type()->isa<TupleType>())) {
-                    // structs are passed via buffer; the parameter is a pointer to this buffer
-                    func_decls_ << "__global ";
-                    func_impl_  << "__global ";
-                    emit_type(func_decls_, param->type()) << " *";
-                    emit_type(func_impl_,  param->type()) << " *" << param->unique_name() << "_";
-                } else if (lang_ == Lang::HLS && continuation->is_exported() && param->type()->isa<PtrType>()) {
-                    auto array_size = config->as<HLSKernelConfig>()->param_size(param);
-                    assert(array_size > 0);
-                    auto ptr_type = param->type()->as<PtrType>();
-                    auto elem_type = ptr_type->pointee();
-                    if (auto array_type = elem_type->isa<ArrayType>())
-                        elem_type = array_type->elem_type();
-                    emit_type(func_decls_, elem_type) << "[" << array_size << "]";
-                    emit_type(func_impl_,  elem_type) << " " << param->unique_name() << "[" << array_size << "]";
-                    if (elem_type->isa<StructType>() || elem_type->isa<DefiniteArrayType>())
-                        hls_pragmas += "#pragma HLS data_pack variable=" + param->unique_name() + " struct_level\n";
-                } else {
-                    std::string qualifier;
-                    // add restrict qualifier when possible
-                    if ((lang_ == Lang::OPENCL || lang_ == Lang::CUDA) &&
-                        config && config->as<GPUKernelConfig>()->has_restrict() &&
-                        param->type()->isa<PtrType>()) {
-                        qualifier = lang_ == Lang::CUDA ? " __restrict" : " restrict";
-                    }
-                    emit_addr_space(func_decls_, param->type());
-                    emit_addr_space(func_impl_,  param->type());
-                    emit_type(func_decls_, param->type()) << qualifier;
-                    emit_type(func_impl_,  param->type()) << qualifier << " " << param->unique_name();
-                }
-                insert(param, param->unique_name());
-            }
+    plan_block(scope.entry());
+    emit_block(scope.entry());
+    func_impl_ << down << endl << "}" << endl << endl;
+
+    // only the output is needed from now on
+    def2str_.clear();
+    type2str_.clear();
+    jumps_.clear();
+    labels_.clear();
+    direct_.clear();
+    coalesced_.clear();
+    dataflow_.reset();
+    pipelining_.reset();
+}
+
+void CCodeGen::coalesce_params() {
+    // plain jumps to basic blocks of this function - all other jumps assign a single param
+    auto jump_target = [&] (Continuation* continuation) -> Continuation* {
+        if (continuation->empty())
+            return nullptr;
+        auto callee = continuation->callee()->isa_continuation();
+        return callee && callee->is_basicblock() && scope_->contains(callee) ? callee : nullptr;
+    };
+
+    // params are assigned without phi variable unless a jump passes them on to another param of their block,
+    // which must see the old value
+    for (const auto& block : *schedule_) {
+        if (block.continuation() == scope_->entry())
+            continue;
+        for (auto param : block.continuation()->params()) {
+            if (!is_mem(param) && !is_unit(param))
+                direct_.insert(param);
         }
-        func_decls_ << ");" << endl;
-        func_impl_  << ") {" << up;
-        if (!hls_pragmas.empty())
-            func_impl_ << down << endl << hls_pragmas << up;
+    }
+    for (const auto& block : *schedule_) {
+        auto callee = jump_target(block.continuation());
+        if (!callee)
+            continue;
+        for (size_t i = 0, e = block.continuation()->num_args(); i != e; ++i) {
+            auto param = block.continuation()->arg(i)->isa<Param>();
+            if (param && param->continuation() == callee && param->index() != i)
+                direct_.erase(param);
+        }
+    }
 
-        // OpenCL: load struct from buffer
-        for (auto param : continuation->params()) {
-            if (is_mem(param) || is_unit(param))
+    // an argument only used by the jump shares the variable of its param if the param is dead from the argument on
+    for (const auto& block : *schedule_) {
+        auto continuation = block.continuation();
+        auto callee = jump_target(continuation);
+        if (!callee)
+            continue;
+        for (size_t i = 0, e = continuation->num_args(); i != e; ++i) {
+            auto param = callee->param(i);
+            auto arg = continuation->arg(i)->isa<PrimOp>();
+            if (!arg || arg->num_uses() != 1 || arg->type() != param->type() || !direct_.contains(param) || coalesced_.contains(param) || is_const(arg))
                 continue;
-            if (param->order() == 0) {
-                if (lang_==Lang::OPENCL && continuation->is_exported() &&
-                    (param->type()->isa<DefiniteArrayType>() ||
-                     param->type()->isa<StructType>() ||
-                     param->type()->isa<TupleType>())) {
-                    func_impl_ << endl;
-                    emit_type(func_impl_, param->type()) << " " << param->unique_name() << " = *" << param->unique_name() << "_;";
-                }
+
+            bool scheduled = false, live = false;
+            for (auto primop : block) {
+                if (primop == arg)
+                    scheduled = true;
+                else if (scheduled && std::find(primop->ops().begin(), primop->ops().end(), param) != primop->ops().end())
+                    live = true;
             }
+            for (auto other : continuation->args())
+                live |= other == param;
+            if (scheduled && !live)
+                coalesced_[param] = arg;
         }
+    }
+}
 
-        Schedule schedule(scope);
+std::string CCodeGen::phi_name(const Param* param) {
+    return direct_.contains(param) ? get_name(param) : "p" + param->unique_name();
+}
 
-        // emit function arguments and phi nodes
-        for (const auto& block : schedule) {
-            for (auto param : block.continuation()->params()) {
-                if (is_mem(param) || is_unit(param))
-                    continue;
-                emit_aggop_decl(param->type());
-                insert(param, param->unique_name());
-            }
+void CCodeGen::plan_block(Continuation* continuation) {
+    bool loop = is_loop_header(continuation);
+    if (loop)
+        enclosing_.push_back({ Enclosing::Loop, continuation });
+    auto merges = merge_blocks(continuation);
+    for (auto i = merges.rbegin(), e = merges.rend(); i != e; ++i)
+        enclosing_.push_back({ Enclosing::Seq, *i });
+
+    // mirrors emit_block in order to find the blocks that are jumped to with goto
+    for_each_jump(continuation, [&] (const Enclosing* enclosing, Continuation* succ) {
+        if (enclosing)
+            enclosing_.push_back(*enclosing);
+        switch (transfer(continuation, succ)) {
+            case Transfer::Inline: plan_block(succ);     break;
+            case Transfer::Goto:   labels_.insert(succ); break;
+            default:                                     break;
+        }
+        if (enclosing)
+            enclosing_.pop_back();
+    });
 
-            auto continuation = block.continuation();
-            if (scope.entry() != continuation) {
-                for (auto param : continuation->params()) {
-                    if (!is_mem(param) && !is_unit(param)) {
-                        func_impl_ << endl;
-                        emit_addr_space(func_impl_, param->type());
-                        emit_type(func_impl_, param->type()) << "  " << param->unique_name() << ";" << endl;
-                        emit_addr_space(func_impl_, param->type());
-                        emit_type(func_impl_, param->type()) << " p" << param->unique_name() << ";";
-                    }
-                }
-            }
-            // emit counter for pipeline intrinsic
-            if (continuation->callee()->isa_continuation() &&
-                continuation->callee()->as_continuation()->intrinsic() == Intrinsic::Pipeline) {
-                func_impl_ << endl << "int i" << continuation->callee()->gid() << ";";
-            }
+    for (auto merge : merges) {
+        enclosing_.pop_back();
+        plan_block(merge);
+    }
+    if (loop)
+        enclosing_.pop_back();
+}
+
+void CCodeGen::emit_block(Continuation* continuation) {
+    assert(continuation == scope_->entry() || continuation->is_basicblock());
+    bool loop = is_loop_header(continuation);
+    if (loop) {
+        auto ii = pipelining_ ? pipelining_->ii(continuation) : 0;
+        func_impl_ << endl << "while (true) {" << up;
+        if (ii != 0)
+            func_impl_ << endl << "#pragma HLS PIPELINE II=" << ii;
+        enclosing_.push_back({ Enclosing::Loop, continuation });
+    }
+    // blocks with several predecessors follow the code of their immediate dominator
+    auto merges = merge_blocks(continuation);
+    for (auto i = merges.rbegin(), e = merges.rend(); i != e; ++i)
+        enclosing_.push_back({ Enclosing::Seq, *i });
+
+    primop2str_.clear();
+    if (labels_.contains(continuation))
+        func_impl_ << endl << "l" << continuation->gid() << ": ;";
+
+    // load params from phi node
+    if (continuation != scope_->entry()) {
+        for (auto param : continuation->params()) {
+            if (is_mem(param) || is_unit(param))
+                continue;
+            if (direct_.contains(param))
+                ++num_coalesced_;
+            else
+                func_impl_ << endl << param->unique_name() << " = p" << param->unique_name() << ";";
         }
+    }
 
-        for (const auto& block : schedule) {
-            auto continuation = block.continuation();
-            if (continuation->empty())
+    for (auto primop : (*schedule_)[scope_->cfa()[continuation]]) {
+        if (primop->type()->order() >= 1) {
+            // ignore higher-order primops which come from a match intrinsic
+            if (is_from_match(primop))
                 continue;
-            assert(continuation == scope.entry() || continuation->is_basicblock());
-            func_impl_ << endl;
+            THORIN_UNREACHABLE;
+        }
 
-            // print label for the current basic block
-            if (continuation != scope.entry()) {
-                func_impl_ << "l" << continuation->gid() << ": ;" << up << endl;
-                // load params from phi node
-                for (auto param : continuation->params())
-                    if (!is_mem(param) && !is_unit(param))
-                        func_impl_ << param->unique_name() << " = p" << param->unique_name() << ";" << endl;
+        // struct/tuple/array declarations
+        if (!primop->isa<MemOp>()) {
+            emit_aggop_decl(primop->type());
+            // search for inlined tuples/arrays
+            if (auto aggop = primop->isa<AggOp>()) {
+                if (!aggop->agg()->isa<MemOp>())
+                    emit_aggop_decl(aggop->agg()->type());
             }
+        }
 
-            for (auto primop : block) {
-                if (primop->type()->order() >= 1) {
-                    // ignore higher-order primops which come from a match intrinsic
-                    if (is_from_match(primop))
-                        continue;
-                    THORIN_UNREACHABLE;
-                }
+        // skip higher-order primops, stuff dealing with frames and all memory related stuff except stores
+        if (primop->type()->isa<FnType>() || primop->type()->isa<FrameType>() || ((is_mem(primop) || is_unit(primop)) && !primop->isa<Store>()))
+            continue;
 
-                // struct/tuple/array declarations
-                if (!primop->isa<MemOp>()) {
-                    emit_aggop_decl(primop->type());
-                    // search for inlined tuples/arrays
-                    if (auto aggop = primop->isa<AggOp>()) {
-                        if (!aggop->agg()->isa<MemOp>())
-                            emit_aggop_decl(aggop->agg()->type());
-                    }
+        emit_debug_info(primop);
+        emit(primop);
+    }
+
+    // emit definitions for temporaries
+    for (auto arg : continuation->args())
+        emit_temporaries(arg);
+
+    // terminate bb
+    if (continuation->callee() == ret_param_) { // return
+        size_t num_args = continuation->num_args();
+        func_impl_ << endl;
+        if (num_args == 0) func_impl_ << "return ;";
+        else {
+            Array<const Def*> values(num_args);
+            Array<const Type*> types(num_args);
+
+            size_t n = 0;
+            for (auto arg : continuation->args()) {
+                if (!is_mem(arg) && !is_unit(arg)) {
+                    values[n] = arg;
+                    types[n] = arg->type();
+                    n++;
                 }
+            }
 
-                // skip higher-order primops, stuff dealing with frames and all memory related stuff except stores
-                if (primop->type()->isa<FnType>() || primop->type()->isa<FrameType>() || ((is_mem(primop) || is_unit(primop)) && !primop->isa<Store>()))
-                    continue;
+            if (n == 0) func_impl_ << "return ;";
+            else if (n == 1) {
+                func_impl_ << "return ";
+                emit(values[0]) << ";";
+            } else {
+                types.shrink(n);
+                auto ret_type = tuple_type(types);
+                auto ret_tuple_name = "ret_tuple" + std::to_string(continuation->gid());
+                emit_aggop_decl(ret_type);
+                emit_type(var_decl(), ret_type) << " " << ret_tuple_name << ";";
+
+                for (size_t i = 0; i != n; ++i) {
+                    func_impl_ << ret_tuple_name << ".e" << i << " = ";
+                    emit(values[i]) << ";" << endl;
+                }
 
-                emit_debug_info(primop);
-                emit(primop) << endl;
+                func_impl_ << "return " << ret_tuple_name << ";";
             }
+        }
+    } else if (continuation->callee() == world().branch()) {
+        auto then_cont = continuation->arg(1)->as_continuation();
+        auto else_cont = continuation->arg(2)->as_continuation();
+        enclosing_.push_back({ Enclosing::If, nullptr });
+        auto then_transfer = transfer(continuation, then_cont);
+        auto else_transfer = transfer(continuation, else_cont);
+        // a branch that falls through to the code following the conditional needs no statement
+        if (then_transfer != Transfer::Fall || else_transfer != Transfer::Fall) {
+            emit_debug_info(continuation->arg(0)); // TODO correct?
+            func_impl_ << endl << (then_transfer == Transfer::Fall ? "if (!" : "if (");
+            emit(continuation->arg(0)) << ") {" << up;
+            emit_jump(continuation, then_transfer == Transfer::Fall ? else_cont : then_cont);
+            if (then_transfer != Transfer::Fall && else_transfer != Transfer::Fall) {
+                func_impl_ << down << endl << "} else {" << up;
+                emit_jump(continuation, else_cont);
+            }
+            func_impl_ << down << endl << "}";
+        }
+        enclosing_.pop_back();
+    } else if (continuation->callee()->isa<Continuation>() &&
+               continuation->callee()->as<Continuation>()->intrinsic() == Intrinsic::Match) {
+        enclosing_.push_back({ Enclosing::Switch, nullptr });
+        func_impl_ << endl << "switch (";
+        emit(continuation->arg(0)) << ") {" << up;
+        for (size_t i = 2; i < continuation->num_args(); i++) {
+            auto arg = continuation->arg(i)->as<Tuple>();
+            func_impl_ << endl << "case ";
+            emit(arg->op(0)) << ":" << up;
+            emit_jump(continuation, arg->op(1)->as_continuation());
+            func_impl_ << down;
+        }
+        func_impl_ << endl << "default:" << up;
+        emit_jump(continuation, continuation->arg(1)->as_continuation());
+        func_impl_ << down << down << endl << "}";
+        enclosing_.pop_back();
+    } else if (continuation->callee()->isa<Bottom>()) {
+        func_impl_ << endl << "return ; // bottom: unreachable";
+    } else {
+        auto store_phi = [&] (const Param* param, const Def* arg) {
+            // coalesced arguments are already in the variable of the param
+            if (direct_.contains(param) && (arg == param || (coalesced_.contains(param) && coalesced_[param] == arg))) {
+                ++num_coalesced_;
+                return;
+            }
+            func_impl_ << endl << phi_name(param) << " = ";
+            emit(arg) << ";";
+        };
 
-            // emit definitions for temporaries
-            for (auto arg : continuation->args())
-                emit_temporaries(arg);
+        auto callee = continuation->callee()->as_continuation();
+        emit_debug_info(callee);
 
-            // terminate bb
-            if (continuation->callee() == ret_param) { // return
-                size_t num_args = continuation->num_args();
-                if (num_args == 0) func_impl_ << "return ;";
-                else {
-                    Array<const Def*> values(num_args);
-                    Array<const Type*> types(num_args);
+        if (callee->is_basicblock()) {   // ordinary jump
+            assert(callee->num_params()==continuation->num_args());
+            for (size_t i = 0, size = callee->num_params(); i != size; ++i)
+                if (!is_mem(callee->param(i)) && !is_unit(callee->param(i)))
+                    store_phi(callee->param(i), continuation->arg(i));
+            emit_jump(continuation, callee);
+        } else {
+            if (callee->is_intrinsic()) {
+                if (callee->intrinsic() == Intrinsic::Reserve) {
+                    if (!continuation->arg(1)->isa<PrimLit>())
+                        EDEF(continuation->arg(1), "reserve_shared: couldn't extract memory size");
+
+                    auto& os = var_decl();
+                    switch (lang_) {
+                        default:                                break;
+                        case Lang::CUDA:   os << "__shared__ "; break;
+                        case Lang::OPENCL: os << "__local ";    break;
+                    }
 
-                    size_t n = 0;
-                    for (auto arg : continuation->args()) {
-                        if (!is_mem(arg) && !is_unit(arg)) {
-                            values[n] = arg;
-                            types[n] = arg->type();
-                            n++;
+                    auto cont = continuation->arg(2)->as_continuation();
+                    auto elem_type = cont->param(1)->type()->as<PtrType>()->pointee()->as<ArrayType>()->elem_type();
+                    auto name = "reserver_" + cont->param(1)->unique_name();
+                    emit_type(os, elem_type) << " " << name << "[" << primlit_value<uint64_t>(continuation->arg(1)) << "];";
+                    if (lang_ == Lang::HLS) {
+                        var_decl() << "#pragma HLS dependence variable=" << name << " inter false";
+                        var_decl() << "#pragma HLS data_pack  variable=" << name;
+                        if (dataflow_ && dataflow_->is_stream(cont->param(1)))
+                            var_decl() << "#pragma HLS stream variable=" << name;
+                    }
+                    // store_phi:
+                    func_impl_ << endl << phi_name(cont->param(1)) << " = " << name << ";";
+                    emit_jump(continuation, cont);
+                } else if (callee->intrinsic() == Intrinsic::Pipeline) {
+                    assert((lang_ == Lang::OPENCL || lang_ == Lang::HLS) && "pipelining not supported on this backend");
+                    // cast to continuation to get unique name of "for index"
+                    auto body = continuation->arg(4)->as_continuation();
+                    if (lang_ == Lang::OPENCL) {
+                        if (continuation->arg(1)->as<PrimLit>()->value().get_s32() !=0) {
+                            func_impl_ << endl << "#pragma ii ";
+                            emit(continuation->arg(1));
+                        } else {
+                            func_impl_ << endl << "#pragma ii 1";
                         }
                     }
-
-                    if (n == 0) func_impl_ << "return ;";
-                    else if (n == 1) {
-                        func_impl_ << "return ";
-                        emit(values[0]) << ";";
-                    } else {
-                        types.shrink(n);
-                        auto ret_type = world_.tuple_type(types);
-                        auto ret_tuple_name = "ret_tuple" + std::to_string(continuation->gid());
-                        emit_aggop_decl(ret_type);
-                        emit_type(func_impl_, ret_type) << " " << ret_tuple_name << ";";
-
-                        for (size_t i = 0; i != n; ++i) {
-                            func_impl_ << endl << ret_tuple_name << ".e" << i << " = ";
-                            emit(values[i]) << ";";
+                    func_impl_ << endl << "for (i" << callee->gid() << " = ";
+                    emit(continuation->arg(2));
+                    func_impl_ << "; i" << callee->gid() << " < ";
+                    emit(continuation->arg(3)) <<"; i" << callee->gid() << "++) {"<< up;
+                    if (lang_ == Lang::HLS) {
+                        if (continuation->arg(1)->as<PrimLit>()->value().get_s32() != 0) {
+                            func_impl_ << endl << "#pragma HLS PIPELINE II=";
+                            emit(continuation->arg(1));
+                        } else {
+                            func_impl_ << endl << "#pragma HLS PIPELINE";
                         }
-
-                        func_impl_ << endl << "return " << ret_tuple_name << ";";
                     }
+                    // emit body and "for index" as the "body parameter"
+                    auto next = continuation->arg(6)->as_continuation();
+                    func_impl_ << endl << phi_name(body->param(1)) << " = i"<< callee->gid()<< ";";
+                    enclosing_.push_back({ Enclosing::For, next });
+                    emit_jump(continuation, body);
+                    enclosing_.pop_back();
+                    // emit "continue" with according label used for goto
+                    if (labels_.contains(next))
+                        func_impl_ << endl << "l" << next->gid() << ": continue;";
+                    func_impl_ << down << endl << "}";
+                    if (continuation->arg(5) == ret_param_)
+                        func_impl_ << endl << "return;";
+                    else
+                        emit_jump(continuation, continuation->arg(5)->as_continuation());
+                } else if (callee->intrinsic() == Intrinsic::PipelineContinue) {
+                    emit_jump(continuation, callee);
+                } else {
+                    THORIN_UNREACHABLE;
                 }
-            } else if (continuation->callee() == world().branch()) {
-                emit_debug_info(continuation->arg(0)); // TODO correct?
-                func_impl_ << "if (";
-                emit(continuation->arg(0));
-                func_impl_ << ") ";
-                emit(continuation->arg(1));
-                func_impl_ << " else ";
-                emit(continuation->arg(2));
-            } else if (continuation->callee()->isa<Continuation>() &&
-                       continuation->callee()->as<Continuation>()->intrinsic() == Intrinsic::Match) {
-                func_impl_ << "switch (";
-                emit(continuation->arg(0)) << ") {" << up << endl;
-                for (size_t i = 2; i < continuation->num_args(); i++) {
-                    auto arg = continuation->arg(i)->as<Tuple>();
-                    func_impl_ << "case ";
-                    emit(arg->op(0)) << ": ";
-                    emit(arg->op(1)) << endl;
-                }
-                func_impl_ << "default: ";
-                emit(continuation->arg(1));
-                func_impl_ << down << endl << "}";
-            } else if (continuation->callee()->isa<Bottom>()) {
-                func_impl_ << "return ; // bottom: unreachable";
             } else {
-                auto store_phi = [&] (const Def* param, const Def* arg) {
-                    func_impl_ << "p" << param->unique_name() << " = ";
-                    emit(arg) << ";";
+                auto emit_call = [&] (const Param* param = nullptr) {
+                    auto name = (callee->is_exported() || callee->empty()) ? callee->name() : callee->unique_name();
+                    if (param)
+                        emit(param) << " = ";
+                    func_impl_ << name << "(";
+                    // emit all first-order args
+                    size_t i = 0;
+                    for (auto arg : continuation->args()) {
+                        if (arg->order() == 0 && !(is_mem(arg) || is_unit(arg))) {
+                            if (i++ > 0)
+                                func_impl_ << ", ";
+                            emit(arg);
+                        }
+                    }
+                    func_impl_ << ");";
+                    if (param)
+                        store_phi(param, param);
                 };
 
-                auto callee = continuation->callee()->as_continuation();
-                emit_debug_info(callee);
-
-                if (callee->is_basicblock()) {   // ordinary jump
-                    assert(callee->num_params()==continuation->num_args());
-                    for (size_t i = 0, size = callee->num_params(); i != size; ++i)
-                        if (!is_mem(callee->param(i)) && !is_unit(callee->param(i))) {
-                            store_phi(callee->param(i), continuation->arg(i));
-                            func_impl_ << endl;
-                        }
-                    emit(callee);
-                } else {
-                    if (callee->is_intrinsic()) {
-                        if (callee->intrinsic() == Intrinsic::Reserve) {
-                            if (!continuation->arg(1)->isa<PrimLit>())
-                                EDEF(continuation->arg(1), "reserve_shared: couldn't extract memory size");
-
-                            switch (lang_) {
-                                default:                                        break;
-                                case Lang::CUDA:   func_impl_ << "__shared__ "; break;
-                                case Lang::OPENCL: func_impl_ << "__local ";    break;
-                            }
-
-                            auto cont = continuation->arg(2)->as_continuation();
-                            auto elem_type = cont->param(1)->type()->as<PtrType>()->pointee()->as<ArrayType>()->elem_type();
-                            auto name = "reserver_" + cont->param(1)->unique_name();
-                            emit_type(func_impl_, elem_type) << " " << name << "[";
-                            emit(continuation->arg(1)) << "];" << endl;
-                            // store_phi:
-                            func_impl_ << "p" << cont->param(1)->unique_name() << " = " << name << ";";
-                            if (lang_ == Lang::HLS)
-                                func_impl_ << endl
-                                           << "#pragma HLS dependence variable=" << name << " inter false" << endl
-                                           << "#pragma HLS data_pack  variable=" << name;
-                        } else if (callee->intrinsic() == Intrinsic::Pipeline) {
-                            assert((lang_ == Lang::OPENCL || lang_ == Lang::HLS) && "pipelining not supported on this backend");
-                            // cast to continuation to get unique name of "for index"
-                            auto body = continuation->arg(4)->as_continuation();
-                            if (lang_ == Lang::OPENCL) {
-                                if (continuation->arg(1)->as<PrimLit>()->value().get_s32() !=0) {
-                                    func_impl_ << "#pragma ii ";
-                                    emit(continuation->arg(1)) << endl;
-                                } else {
-                                    func_impl_ << "#pragma ii 1"<< endl;
-                                }
-                            }
-                            func_impl_ << "for (i" << callee->gid() << " = ";
-                            emit(continuation->arg(2));
-                            func_impl_ << "; i" << callee->gid() << " < ";
-                            emit(continuation->arg(3)) <<"; i" << callee->gid() << "++) {"<< up << endl;
-                            if (lang_ == Lang::HLS) {
-                                if (continuation->arg(1)->as<PrimLit>()->value().get_s32() != 0) {
-                                    func_impl_ << "#pragma HLS PIPELINE II=";
-                                    emit(continuation->arg(1)) << endl;
-                                } else {
-                                    func_impl_ << "#pragma HLS PIPELINE"<< endl;
-                                }
-                            }
-                            // emit body and "for index" as the "body parameter"
-                            func_impl_ << "p" << body->param(1)->unique_name() << " = i"<< callee->gid()<< ";" << endl;
-                            emit(body);
-                            // emit "continue" with according label used for goto
-                            func_impl_ << down << endl << "l" << continuation->arg(6)->gid() << ": continue;" << endl << "}" << endl;
-                            if (continuation->arg(5) == ret_param)
-                                func_impl_ << "return;" << endl;
-                            else
-                                emit(continuation->arg(5));
-                        } else if (callee->intrinsic() == Intrinsic::PipelineContinue) {
-                            func_impl_ << "goto l" << callee->gid() << ";" << endl;
-                        } else {
-                            THORIN_UNREACHABLE;
-                        }
-                    } else {
-                        auto emit_call = [&] (const Param* param = nullptr) {
-                            auto name = (callee->is_exported() || callee->empty()) ? callee->name() : callee->unique_name();
-                            if (param)
-                                emit(param) << " = ";
-                            func_impl_ << name << "(";
-                            // emit all first-order args
-                            size_t i = 0;
-                            for (auto arg : continuation->args()) {
-                                if (arg->order() == 0 && !(is_mem(arg) || is_unit(arg))) {
-                                    if (i++ > 0)
-                                        func_impl_ << ", ";
-                                    emit(arg);
-                                }
-                            }
-                            func_impl_ << ");";
-                            if (param) {
-                                func_impl_ << endl;
-                                store_phi(param, param);
-                            }
-                        };
-
-                        const Def* ret_arg = 0;
-                        for (auto arg : continuation->args()) {
-                            if (arg->order() != 0) {
-                                assert(!ret_arg);
-                                ret_arg = arg;
-                            }
-                        }
+                const Def* ret_arg = 0;
+                for (auto arg : continuation->args()) {
+                    if (arg->order() != 0) {
+                        assert(!ret_arg);
+                        ret_arg = arg;
+                    }
+                }
 
-                        // must be call + continuation --- call + return has been removed by codegen_prepare
-                        auto succ = ret_arg->as_continuation();
-                        size_t num_params = succ->num_params();
-
-                        size_t n = 0;
-                        Array<const Param*> values(num_params);
-                        Array<const Type*> types(num_params);
-                        for (auto param : succ->params()) {
-                            if (!is_mem(param) && !is_unit(param)) {
-                                values[n] = param;
-                                types[n] = param->type();
-                                n++;
-                            }
-                        }
+                // must be call + continuation --- call + return has been removed by codegen_prepare
+                auto succ = ret_arg->as_continuation();
+                size_t num_params = succ->num_params();
 
-                        if (n == 0)
-                            emit_call();
-                        else if (n == 1)
-                            emit_call(values[0]);
-                        else {
-                            types.shrink(n);
-                            auto ret_type = world_.tuple_type(types);
-                            auto ret_tuple_name = "ret_tuple" + std::to_string(continuation->gid());
-                            emit_aggop_decl(ret_type);
-                            emit_type(func_impl_, ret_type) << " " << ret_tuple_name << ";" << endl << ret_tuple_name << " = ";
-                            emit_call();
-
-                            // store arguments to phi node
-                            for (size_t i = 0; i != n; ++i)
-                                func_impl_ << endl << "p" << values[i]->unique_name() << " = " << ret_tuple_name << ".e" << i << ";";
-                        }
+                size_t n = 0;
+                Array<const Param*> values(num_params);
+                Array<const Type*> types(num_params);
+                for (auto param : succ->params()) {
+                    if (!is_mem(param) && !is_unit(param)) {
+                        values[n] = param;
+                        types[n] = param->type();
+                        n++;
                     }
                 }
+
+                func_impl_ << endl;
+                if (n == 0)
+                    emit_call();
+                else if (n == 1)
+                    emit_call(values[0]);
+                else {
+                    types.shrink(n);
+                    auto ret_type = tuple_type(types);
+                    auto ret_tuple_name = "ret_tuple" + std::to_string(continuation->gid());
+                    emit_aggop_decl(ret_type);
+                    emit_type(var_decl(), ret_type) << " " << ret_tuple_name << ";";
+                    func_impl_ << ret_tuple_name << " = ";
+                    emit_call();
+
+                    // store arguments to phi node
+                    for (size_t i = 0; i != n; ++i)
+                        func_impl_ << endl << phi_name(values[i]) << " = " << ret_tuple_name << ".e" << i << ";";
+                }
+                emit_jump(continuation, succ);
             }
-            if (continuation != scope.entry())
-                func_impl_ << down;
-            primop2str_.clear();
         }
-        func_impl_ << down << endl << "}" << endl << endl;
-        def2str_.clear();
-    });
+    }
 
-    type2str_.clear();
-    global2str_.clear();
+    for (auto merge : merges) {
+        enclosing_.pop_back();
+        emit_block(merge);
+    }
+    if (loop) {
+        enclosing_.pop_back();
+        func_impl_ << down << endl << "}";
+    }
+}
 
-    if (lang_==Lang::OPENCL) {
-        if (use_channels_)
-            os_ << "#pragma OPENCL EXTENSION cl_intel_channels : enable" << endl;
-        if (use_16_)
-            os_ << "#pragma OPENCL EXTENSION cl_khr_fp16 : enable" << endl;
-        if (use_64_)
-            os_ << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable" << endl;
-        if (use_channels_ || use_16_ || use_64_)
-            os_ << endl;
+void CCodeGen::emit_jump(Continuation* from, Continuation* to) {
+    switch (transfer(from, to)) {
+        case Transfer::Inline:   emit_block(to);                                     break;
+        case Transfer::Fall:                                                         break;
+        case Transfer::Break:    func_impl_ << endl << "break;";                     break;
+        case Transfer::Continue: func_impl_ << endl << "continue;";                  break;
+        case Transfer::Goto:     func_impl_ << endl << "goto l" << to->gid() << ";"; break;
     }
+}
 
-    if (lang_==Lang::CUDA && use_16_) {
-        os_ << "#include <cuda_fp16.h>" << endl << endl;
-        os_ << "#if __CUDACC_VER_MAJOR__ > 8" << endl
-            << "#define half __half_raw" << endl
-            << "#endif" << endl << endl;
+template<class F>
+void CCodeGen::for_each_jump(Continuation* continuation, F f) {
+    auto callee = continuation->callee();
+    if (callee == ret_param_ || callee->isa<Bottom>())
+        return;
+
+    if (callee == world().branch()) {
+        Enclosing enclosing = { Enclosing::If, nullptr };
+        f(&enclosing, continuation->arg(1)->as_continuation());
+        f(&enclosing, continuation->arg(2)->as_continuation());
+    } else if (callee->as_continuation()->intrinsic() == Intrinsic::Match) {
+        Enclosing enclosing = { Enclosing::Switch, nullptr };
+        for (size_t i = 2; i < continuation->num_args(); i++)
+            f(&enclosing, continuation->arg(i)->as<Tuple>()->op(1)->as_continuation());
+        f(&enclosing, continuation->arg(1)->as_continuation());
+    } else if (callee->as_continuation()->is_basicblock() || callee->as_continuation()->intrinsic() == Intrinsic::PipelineContinue) {
+        f(nullptr, callee->as_continuation());
+    } else if (callee->as_continuation()->intrinsic() == Intrinsic::Reserve) {
+        f(nullptr, continuation->arg(2)->as_continuation());
+    } else if (callee->as_continuation()->intrinsic() == Intrinsic::Pipeline) {
+        Enclosing enclosing = { Enclosing::For, continuation->arg(6)->as_continuation() };
+        f(&enclosing, continuation->arg(4)->as_continuation());
+        if (continuation->arg(5) != ret_param_)
+            f(nullptr, continuation->arg(5)->as_continuation());
+    } else {
+        for (auto arg : continuation->args()) {
+            if (arg->order() != 0)
+                f(nullptr, arg->as_continuation());
+        }
     }
+}
 
-    if (lang_==Lang::CUDA || lang_==Lang::HLS)
-        os_ << "extern \"C\" {" << endl;
+CCodeGen::Transfer CCodeGen::transfer(Continuation* from, Continuation* to) {
+    if (!to->empty() && jumps_[to] == 1 && !is_back_edge(from, to))
+        return Transfer::Inline;
+
+    // block reached by falling off the end of the statements enclosed by the first n entries of enclosing_
+    auto next = [&] (size_t n) -> Continuation* {
+        while (n-- != 0) {
+            switch (enclosing_[n].tag) {
+                case Enclosing::If:     continue;
+                case Enclosing::Switch: return nullptr; // falls through to the next case
+                default:                return enclosing_[n].continuation;
+            }
+        }
+        return nullptr;
+    };
 
-    if (!type_decls_.str().empty())
-        os_ << type_decls_.str() << endl;
-    if (!func_decls_.str().empty())
-        os_ << func_decls_.str() << endl;
-    os_ << func_impl_.str();
+    if (next(enclosing_.size()) == to)
+        return Transfer::Fall;
+
+    // break leaves the innermost switch or loop, continue starts the next iteration of the innermost loop
+    bool breakable = true;
+    for (size_t i = enclosing_.size(); i-- != 0;) {
+        const auto& enclosing = enclosing_[i];
+        if (enclosing.tag == Enclosing::Switch && breakable) {
+            if (next(i) == to)
+                return Transfer::Break;
+            breakable = false;
+        } else if (enclosing.tag == Enclosing::Loop || enclosing.tag == Enclosing::For) {
+            if (enclosing.continuation == to)
+                return Transfer::Continue;
+            // the code following a pipelined loop is not part of enclosing_
+            if (breakable && enclosing.tag == Enclosing::Loop && next(i) == to)
+                return Transfer::Break;
+            break;
+        }
+    }
+    return Transfer::Goto;
+}
 
-    if (lang_==Lang::CUDA || lang_==Lang::HLS)
-        os_ << "}"; // extern "C"
+bool CCodeGen::is_loop_header(Continuation* continuation) {
+    auto n = scope_->cfa()[continuation];
+    auto head = scope_->f_cfg().looptree()[n]->parent();
+    // irreducible loops have several headers and are left to gotos
+    return head->num_cf_nodes() == 1 && head->cf_nodes().front() == n;
+}
+
+bool CCodeGen::is_back_edge(Continuation* from, Continuation* to) {
+    const auto& cfa = scope_->cfa();
+    return is_loop_header(to) && scope_->f_cfg().domtree().dominates(cfa[to], cfa[from]);
+}
+
+std::vector<Continuation*> CCodeGen::merge_blocks(Continuation* continuation) {
+    const auto& cfa = scope_->cfa();
+    const auto& cfg = scope_->f_cfg();
+    std::vector<Continuation*> merges;
+    for (auto child : cfg.domtree().children(cfa[continuation])) {
+        auto block = child->continuation();
+        if (!block->empty() && jumps_[block] != 1)
+            merges.push_back(block);
+    }
+    std::sort(merges.begin(), merges.end(), [&] (Continuation* a, Continuation* b) { return cfg.index(cfa[a]) < cfg.index(cfa[b]); });
+    return merges;
 }
 
 void CCodeGen::emit_c_int() {
@@ -904,10 +1383,13 @@ void CCodeGen::emit_c_int() {
     os_ << "extern \"C\" {" << endl;
     os_ << "#endif" << endl << endl;
 
-    if (!type_decls_.str().empty())
-        os_ << type_decls_.str() << endl;
-    if (!func_decls_.str().empty())
-        os_ << func_decls_.str() << endl;
+    if (!type_decls_.empty()) {
+        for (auto& decl : type_decls_)
+            os_ << decl.second;
+        os_ << endl;
+    }
+    if (!func_decls_.empty())
+        func_decls_.write_to(os_) << endl;
 
     os_ << "#ifdef __cplusplus" << endl;
     os_ << "}" << endl;
@@ -963,9 +1445,6 @@ std::ostream& CCodeGen::emit_float(T t, IsInfFn is_inf, IsNanFn is_nan) {
 }
 
 std::ostream& CCodeGen::emit(const Def* def) {
-    if (auto continuation = def->isa<Continuation>())
-        return func_impl_ << "goto l" << continuation->gid() << ";";
-
     if (lookup(def))
         return func_impl_ << get_name(def);
 
@@ -978,8 +1457,12 @@ std::ostream& CCodeGen::emit(const Def* def) {
         // emit definitions of inlined elements
         emit_aggop_defs(bin->lhs());
         emit_aggop_defs(bin->rhs());
-        emit_type(func_impl_, bin->type()) << " " << def_name << ";" << endl;
-        func_impl_ << def_name << " = ";
+        emit_type(var_decl(), bin->type()) << " " << def_name << ";";
+        func_impl_ << endl << def_name << " = ";
+        // vector comparisons yield masks with the element size of the operands
+        bool convert_mask = bin->isa<Cmp>() && vector_length(bin->type()) > 1 && lang_ != Lang::CUDA;
+        if (convert_mask)
+            func_impl_ << (lang_ == Lang::OPENCL ? "convert_" + vector_name(bin->type()->as<PrimType>()) + "(" : "__builtin_convertvector(");
         emit(bin->lhs());
         if (auto cmp = bin->isa<Cmp>()) {
             switch (cmp->cmp_tag()) {
@@ -1006,7 +1489,13 @@ std::ostream& CCodeGen::emit(const Def* def) {
                 case ArithOp_shr: func_impl_ << " >> "; break;
             }
         }
-        emit(bin->rhs()) << ";";
+        emit(bin->rhs());
+        if (convert_mask) {
+            if (lang_ != Lang::OPENCL)
+                func_impl_ << ", " << vector_name(bin->type()->as<PrimType>());
+            func_impl_ << ")";
+        }
+        func_impl_ << ";";
         insert(def, def_name);
         return func_impl_;
     }
@@ -1021,15 +1510,16 @@ std::ostream& CCodeGen::emit(const Def* def) {
         // string handling: bitcast [n*pu8]* -> [pu8]*
         if (conv->from()->isa<Global>() && is_string_type(conv->from()->as<Global>()->init()->type())) {
             if (dst_ptr && dst_ptr->pointee()->isa<IndefiniteArrayType>()) {
-                func_impl_ << "// skipped string bitcast: ";
+                func_impl_ << endl << "// skipped string bitcast: ";
                 emit(conv->from());
                 insert(def, get_name(conv->from()));
                 return func_impl_;
             }
         }
 
-        emit_addr_space(func_impl_, dst_type);
-        emit_type(func_impl_, dst_type) << " " << def_name << ";" << endl;
+        emit_addr_space(var_decl(), dst_type);
+        emit_type(func_head_, dst_type) << " " << def_name << ";";
+        func_impl_ << endl;
 
         if (src_ptr && dst_ptr && src_ptr->addr_space() == dst_ptr->addr_space()) {
             func_impl_ << def_name << " = (";
@@ -1053,6 +1543,15 @@ std::ostream& CCodeGen::emit(const Def* def) {
             } else if (lang_==Lang::CUDA && to && (to->primtype_tag() == PrimType_pf16 || to->primtype_tag() == PrimType_qf16)) {
                 func_impl_ << "__float2half((float)";
                 emit(conv->from()) << ");";
+            } else if (lang_ != Lang::CUDA && to && to->is_vector()) {
+                // C-style casts reinterpret vectors; masks of bool vectors are negated to yield ones
+                func_impl_ << (lang_ == Lang::OPENCL ? "convert_" + vector_name(to) + "(" : "__builtin_convertvector(");
+                if (from->primtype_tag() == PrimType_bool)
+                    func_impl_ << "-";
+                emit(conv->from());
+                if (lang_ != Lang::OPENCL)
+                    func_impl_ << ", " << vector_name(to);
+                func_impl_ << ");";
             } else {
                 func_impl_ << "(";
                 emit_addr_space(func_impl_, dst_type);
@@ -1062,12 +1561,12 @@ std::ostream& CCodeGen::emit(const Def* def) {
         }
 
         if (conv->isa<Bitcast>()) {
-            func_impl_ << "union { ";
-            emit_addr_space(func_impl_, dst_type);
-            emit_type(func_impl_, dst_type) << " dst; ";
-            emit_addr_space(func_impl_, src_type);
-            emit_type(func_impl_, src_type) << " src; ";
-            func_impl_ << "} u" << def_name << ";" << endl;
+            var_decl() << "union { ";
+            emit_addr_space(func_head_, dst_type);
+            emit_type(func_head_, dst_type) << " dst; ";
+            emit_addr_space(func_head_, src_type);
+            emit_type(func_head_, src_type) << " src; ";
+            func_head_ << "} u" << def_name << ";";
             func_impl_ << "u" << def_name << ".src = ";
             emit(conv->from()) << ";" << endl;
             func_impl_ << def_name << " = u" << def_name << ".dst;";
@@ -1095,7 +1594,8 @@ std::ostream& CCodeGen::emit(const Def* def) {
         for (auto op : array->ops())
             emit_aggop_defs(op);
 
-        emit_type(func_impl_, array->type()) << " " << def_name << ";" << endl << "{" << up << endl;
+        emit_type(var_decl(), array->type()) << " " << def_name << ";";
+        func_impl_ << endl << "{" << up << endl;
         emit_type(func_impl_, array->type()) << " " << def_name << "_tmp = { { ";
         for (size_t i = 0, e = array->num_ops(); i != e; ++i)
             emit(array->op(i)) << ", ";
@@ -1105,6 +1605,33 @@ std::ostream& CCodeGen::emit(const Def* def) {
         return func_impl_;
     }
 
+    if (auto vector = def->isa<Vector>()) {
+        if (!vector->type()->isa<PrimType>())
+            THORIN_UNREACHABLE; // vectors of pointers are not supported
+        // emit definitions of inlined elements
+        for (auto op : vector->ops())
+            emit_aggop_defs(op);
+
+        emit_type(var_decl(), vector->type()) << " " << def_name << ";";
+        func_impl_ << endl << def_name << " = ";
+        switch (lang_) {
+            case Lang::CUDA:   emit_type(func_impl_ << "make_", vector->type()) << "(";    break;
+            case Lang::OPENCL: emit_type(func_impl_ << "(", vector->type()) << ")(";      break;
+            default:           emit_type(func_impl_ << "(", vector->type()) << "){ ";     break;
+        }
+        for (size_t i = 0, e = vector->num_ops(); i != e; ++i) {
+            if (i > 0)
+                func_impl_ << ", ";
+            // masks have all bits set
+            if (vector->op(i)->type() == world().type_bool())
+                func_impl_ << "-";
+            emit(vector->op(i));
+        }
+        func_impl_ << (lang_ == Lang::CUDA || lang_ == Lang::OPENCL ? ");" : " };");
+        insert(def, def_name);
+        return func_impl_;
+    }
+
     if (auto agg = def->isa<Aggregate>()) {
         emit_aggop_decl(def->type());
         assert(def->isa<Tuple>() || def->isa<StructAgg>());
@@ -1112,7 +1639,8 @@ std::ostream& CCodeGen::emit(const Def* def) {
         for (auto op : agg->ops())
             emit_aggop_defs(op);
 
-        emit_type(func_impl_, agg->type()) << " " << def_name << ";" << endl << "{" << up<< endl;
+        emit_type(var_decl(), agg->type()) << " " << def_name << ";";
+        func_impl_ << endl << "{" << up << endl;
         emit_type(func_impl_, agg->type()) << " " << def_name << "_tmp = { " << up;
         for (size_t i = 0, e = agg->ops().size(); i != e; ++i) {
             func_impl_ << endl;
@@ -1128,6 +1656,14 @@ std::ostream& CCodeGen::emit(const Def* def) {
         emit_aggop_defs(aggop->agg());
 
         auto emit_access = [&] (const Def* def, const Def* index) -> std::ostream& {
+            if (def->type()->isa<VectorType>() && !index->isa<PrimLit>() && (lang_ == Lang::CUDA || lang_ == Lang::OPENCL)) {
+                // vectors of CUDA and OpenCL cannot be subscripted
+                func_impl_ << "((";
+                emit_type(func_impl_, vector_elem_type(def->type()->as<PrimType>())) << "*)&";
+                emit(def) << ")[";
+                return emit(index) << "]";
+            }
+            emit(def);
             if (def->type()->isa<ArrayType>()) {
                 func_impl_ << ".e[";
                 emit(index) << "]";
@@ -1137,17 +1673,11 @@ std::ostream& CCodeGen::emit(const Def* def) {
             } else if (def->type()->isa<StructType>()) {
                 func_impl_ << "." << def->type()->as<StructType>()->op_name(primlit_value<size_t>(index));
             } else if (def->type()->isa<VectorType>()) {
-                if (is_primlit(index, 0))
-                    func_impl_ << ".x";
-                else if (is_primlit(index, 1))
-                    func_impl_ << ".y";
-                else if (is_primlit(index, 2))
-                    func_impl_ << ".z";
-                else if (is_primlit(index, 3))
-                    func_impl_ << ".w";
+                if (index->isa<PrimLit>())
+                    emit_component(primlit_value<size_t>(index));
                 else {
-                    func_impl_ << ".s";
-                    emit(index);
+                    func_impl_ << "[";
+                    emit(index) << "]";
                 }
             } else {
                 THORIN_UNREACHABLE;
@@ -1159,27 +1689,27 @@ std::ostream& CCodeGen::emit(const Def* def) {
             if (is_mem(extract) || extract->type()->isa<FrameType>())
                 return func_impl_;
             if (!extract->agg()->isa<Assembly>()) { // extract is a nop for inline assembly
-                emit_type(func_impl_, aggop->type()) << " " << def_name << ";" << endl;
-                func_impl_ << def_name << " = ";
+                emit_type(var_decl(), aggop->type()) << " " << def_name << ";";
+                func_impl_ << endl << def_name << " = ";
                 if (auto memop = extract->agg()->isa<MemOp>())
                     emit(memop) << ";";
-                else {
-                    emit(aggop->agg());
+                else
                     emit_access(aggop->agg(), aggop->index()) << ";";
-                }
             }
             insert(def, def_name);
             return func_impl_;
         }
 
         auto ins = def->as<Insert>();
-        emit_type(func_impl_, aggop->type()) << " " << def_name << ";" << endl;
-        func_impl_ << def_name << " = ";
+        emit_type(var_decl(), aggop->type()) << " " << def_name << ";";
+        func_impl_ << endl << def_name << " = ";
         emit(ins->agg()) << ";" << endl;
-        func_impl_ << def_name;
+        insert(def, def_name);
         emit_access(def, ins->index()) << " = ";
+        // masks have all bits set
+        if (def->type()->isa<VectorType>() && ins->value()->type() == world().type_bool())
+            func_impl_ << "-";
         emit(ins->value()) << ";";
-        insert(def, def_name);
         return func_impl_;
     }
 
@@ -1208,8 +1738,8 @@ std::ostream& CCodeGen::emit(const Def* def) {
     }
 
     if (auto variant = def->isa<Variant>()) {
-        emit_type(func_impl_, variant->type()) << " " << def_name << ";" << endl;
-        func_impl_ << "{" << up << endl;
+        emit_type(var_decl(), variant->type()) << " " << def_name << ";";
+        func_impl_ << endl << "{" << up << endl;
         emit_type(func_impl_, variant->type()) << " " << def_name << "_tmp;" << endl;
         if (!is_type_unit(variant->op(0)->type())) {
             auto variant_type = variant->type()->as<VariantType>();
@@ -1225,16 +1755,16 @@ std::ostream& CCodeGen::emit(const Def* def) {
     }
 
     if (auto variant_index = def->isa<VariantIndex>()) {
-        emit_type(func_impl_, variant_index->type()) << " " << def_name << ";" << endl;
-        func_impl_ << def_name << " = ";
+        emit_type(var_decl(), variant_index->type()) << " " << def_name << ";";
+        func_impl_ << endl << def_name << " = ";
         emit(variant_index->op(0)) << ".tag" << ";";
         insert(def, def_name);
         return func_impl_;
     }
 
     if (auto variant_extract = def->isa<VariantExtract>()) {
-        emit_type(func_impl_, variant_extract->type()) << " " << def_name << ";" << endl;
-        func_impl_ << def_name << " = ";
+        emit_type(var_decl(), variant_extract->type()) << " " << def_name << ";";
+        func_impl_ << endl << def_name << " = ";
         auto variant_type = variant_extract->value()->type()->as<VariantType>();
         emit(variant_extract->op(0)) << ".data." << variant_type->op_name(variant_extract->index()) << ";";
         insert(def, def_name);
@@ -1242,15 +1772,15 @@ std::ostream& CCodeGen::emit(const Def* def) {
     }
 
     if (auto bottom = def->isa<Bottom>()) {
-        emit_addr_space(func_impl_, bottom->type());
-        emit_type(func_impl_, bottom->type()) << " " << def_name << "; // bottom";
+        emit_addr_space(var_decl(), bottom->type());
+        emit_type(func_head_, bottom->type()) << " " << def_name << "; // bottom";
         insert(def, def_name);
         return func_impl_;
     }
 
     if (auto load = def->isa<Load>()) {
-        emit_type(func_impl_, load->out_val()->type()) << " " << def_name << ";" << endl;
-        func_impl_ << def_name << " = ";
+        emit_type(var_decl(), load->out_val_type()) << " " << def_name << ";";
+        func_impl_ << endl << def_name << " = ";
         // handle texture fetches
         if (!is_texture_type(load->ptr()->type()))
             func_impl_ << "*";
@@ -1261,7 +1791,7 @@ std::ostream& CCodeGen::emit(const Def* def) {
     }
 
     if (auto store = def->isa<Store>()) {
-        emit_aggop_defs(store->val()) << "*";
+        emit_aggop_defs(store->val()) << endl << "*";
         emit(store->ptr()) << " = ";
         emit(store->val()) << ";";
 
@@ -1270,9 +1800,9 @@ std::ostream& CCodeGen::emit(const Def* def) {
     }
 
     if (auto slot = def->isa<Slot>()) {
-        emit_type(func_impl_, slot->alloced_type()) << " " << def_name << "_slot;" << endl;
-        emit_type(func_impl_, slot->alloced_type()) << "* " << def_name << ";" << endl;
-        func_impl_ << def_name << " = &" << def_name << "_slot;";
+        emit_type(var_decl(), slot->alloced_type()) << " " << def_name << "_slot;";
+        emit_type(var_decl(), slot->alloced_type()) << "* " << def_name << ";";
+        func_impl_ << endl << def_name << " = &" << def_name << "_slot;";
         insert(def, def_name);
         return func_impl_;
     }
@@ -1280,37 +1810,41 @@ std::ostream& CCodeGen::emit(const Def* def) {
     if (def->isa<Enter>())
         return func_impl_;
 
-    if (def->isa<Vector>()) {
-        THORIN_UNREACHABLE;
-    }
-
     if (auto lea = def->isa<LEA>()) {
         emit_aggop_defs(lea->ptr());
         emit_aggop_defs(lea->index());
         if (is_texture_type(lea->type())) { // handle texture fetches
-            emit_type(func_impl_, lea->ptr_pointee()) << " " << def_name << ";" << endl;
-            func_impl_ << def_name << " = tex1Dfetch(";
+            emit_type(var_decl(), lea->ptr_pointee()) << " " << def_name << ";";
+            func_impl_ << endl << def_name << " = tex1Dfetch(";
             emit(lea->ptr()) << ", ";
             emit(lea->index()) << ");";
         } else if (lea->ptr_pointee()->isa<TupleType>()) {
-            emit_type(func_impl_, lea->type()) << " " << def_name << ";" << endl;
-            func_impl_ << def_name << " = &";
+            emit_type(var_decl(), lea->type()) << " " << def_name << ";";
+            func_impl_ << endl << def_name << " = &";
             emit(lea->ptr()) << "->e";
             emit(lea->index()) << ";";
         } else if (lea->ptr_pointee()->isa<StructType>()) {
-            emit_type(func_impl_, lea->type()) << " " << def_name << ";" << endl;
-            func_impl_ << def_name << " = &";
+            emit_type(var_decl(), lea->type()) << " " << def_name << ";";
+            func_impl_ << endl << def_name << " = &";
             emit(lea->ptr()) << "->";
             func_impl_ << lea->ptr_pointee()->isa<StructType>()->op_name(primlit_value<size_t>(lea->index())) << ";";
         } else if (lea->ptr_pointee()->isa<DefiniteArrayType>()) {
-            emit_type(func_impl_, lea->type()) << " " << def_name << ";" << endl;
-            func_impl_ << def_name << " = &";
+            emit_type(var_decl(), lea->type()) << " " << def_name << ";";
+            func_impl_ << endl << def_name << " = &";
             emit(lea->ptr()) << "->e[";
             emit(lea->index()) << "];";
+        } else if (lea->ptr_pointee()->isa<PrimType>()) { // element of a vector
+            emit_addr_space(var_decl(), lea->type());
+            emit_type(func_head_, lea->type()) << " " << def_name << ";";
+            func_impl_ << endl << def_name << " = (";
+            emit_addr_space(func_impl_, lea->type());
+            emit_type(func_impl_, lea->type()) << ")";
+            emit(lea->ptr()) << " + ";
+            emit(lea->index()) << ";";
         } else {
-            emit_addr_space(func_impl_, lea->ptr()->type());
-            emit_type(func_impl_, lea->type()) << " " << def_name << ";" << endl;
-            func_impl_ << def_name << " = ";
+            emit_addr_space(var_decl(), lea->ptr()->type());
+            emit_type(func_head_, lea->type()) << " " << def_name << ";";
+            func_impl_ << endl << def_name << " = ";
             emit(lea->ptr()) << " + ";
             emit(lea->index()) << ";";
         }
@@ -1331,7 +1865,7 @@ std::ostream& CCodeGen::emit(const Def* def) {
             assert(outputs[index - 1] == "" && "Each use must belong to a unique index.");
             auto name = var_name(extract);
             outputs[index - 1] = name;
-            emit_type(func_impl_, assembly->type()->op(index)) << " " << name << ";" << endl;
+            emit_type(var_decl(), assembly->type()->op(index)) << " " << name << ";";
         }
         // some outputs that were originally there might have been pruned because
         // they are not used but we still need them as operands for the asm
@@ -1339,7 +1873,7 @@ std::ostream& CCodeGen::emit(const Def* def) {
         for (size_t i = 0; i < out_size; ++i) {
             if (outputs[i] == "") {
                 auto name = var_name(assembly) + "_" + std::to_string(i + 1);
-                emit_type(func_impl_, assembly->type()->op(i + 1)) << " " << name << ";" << endl;
+                emit_type(var_decl(), assembly->type()->op(i + 1)) << " " << name << ";";
                 outputs[i] = name;
             }
         }
@@ -1348,7 +1882,7 @@ std::ostream& CCodeGen::emit(const Def* def) {
         for (auto op : assembly->ops())
             emit_temporaries(op);
 
-        func_impl_ << "asm ";
+        func_impl_ << endl << "asm ";
         if (assembly->has_sideeffects())
             func_impl_ << "volatile ";
         if (assembly->is_alignstack() || assembly->is_inteldialect())
@@ -1423,11 +1957,25 @@ std::ostream& CCodeGen::emit(const Def* def) {
         emit_aggop_defs(select->cond());
         emit_aggop_defs(select->tval());
         emit_aggop_defs(select->fval());
-        emit_type(func_impl_, select->type()) << " " << def_name << ";" << endl;
-        func_impl_ << def_name << " = ";
-        emit(select->cond()) << " ? ";
-        emit(select->tval()) << " : ";
-        emit(select->fval()) << ";";
+        emit_type(var_decl(), select->type()) << " " << def_name << ";";
+        if (vector_length(select->cond()->type()) > 1) {
+            // select each component on its own, the masks may differ in size from the elements
+            for (size_t i = 0, e = vector_length(select->cond()->type()); i != e; ++i) {
+                func_impl_ << endl << def_name;
+                emit_component(i) << " = ";
+                emit(select->cond());
+                emit_component(i) << " ? ";
+                emit(select->tval());
+                emit_component(i) << " : ";
+                emit(select->fval());
+                emit_component(i) << ";";
+            }
+        } else {
+            func_impl_ << endl << def_name << " = ";
+            emit(select->cond()) << " ? ";
+            emit(select->tval()) << " : ";
+            emit(select->fval()) << ";";
+        }
         insert(def, def_name);
         return func_impl_;
     }
@@ -1440,32 +1988,42 @@ bool CCodeGen::lookup(const Type* type) {
 }
 
 bool CCodeGen::lookup(const Def* def) {
-    if (def->isa<Global>())
-        return global2str_.contains(def);
-    else if (def->isa<PrimOp>() && is_const(def))
-        return primop2str_.contains(def);
-    else
-        return def2str_.contains(def);
+    return find_name(def) != nullptr;
 }
 
-std::string& CCodeGen::get_name(const Type* type) {
+const std::string& CCodeGen::get_name(const Type* type) {
     return type2str_[type];
 }
 
-std::string& CCodeGen::get_name(const Def* def) {
-    if (def->isa<Global>())
-        return global2str_[def];
-    else if (def->isa<PrimOp>() && is_const(def))
-        return primop2str_[def];
-    else
-        return def2str_[def];
+const std::string& CCodeGen::get_name(const Def* def) {
+    auto name = find_name(def);
+    assert(name);
+    return *name;
 }
 
-const std::string CCodeGen::var_name(const Def* def) {
-    if (def->isa<PrimOp>() && is_const(def))
-        return def->unique_name() + "_" + std::to_string(primop_counter++);
-    else
-        return def->unique_name();
+const std::string* CCodeGen::find_name(const Def* def) {
+    // insert puts each def into exactly one map, so we don't need to run is_const on every lookup
+    auto& map = def->isa<Global>() ? (parent_ ? parent_->global2str_ : global2str_) : def2str_;
+    auto i = map.find(def);
+    if (i != map.end())
+        return &i->second;
+    if (def->isa<PrimOp>()) {
+        auto i = primop2str_.find(def);
+        if (i != primop2str_.end())
+            return &i->second;
+    }
+    return nullptr;
+}
+
+std::string CCodeGen::var_name(const Def* def) {
+    auto name = def->unique_name();
+    if (def->isa<PrimOp>() && is_const(def)) {
+        if (parent_)
+            name.append("_").append(1, counter_mark).append(std::to_string(primop_counter++)).append(1, counter_mark);
+        else
+            name.append("_").append(std::to_string(primop_counter++));
+    }
+    return name;
 }
 const std::string CCodeGen::get_lang() const {
     switch (lang_) {
@@ -1478,16 +2036,16 @@ const std::string CCodeGen::get_lang() const {
 }
 
 void CCodeGen::insert(const Type* type, std::string str) {
-    type2str_[type] = str;
+    type2str_[type] = std::move(str);
 }
 
 void CCodeGen::insert(const Def* def, std::string str) {
     if (def->isa<Global>())
-        global2str_[def] = str;
+        global2str_[def] = std::move(str);
     else if (def->isa<PrimOp>() && is_const(def))
-        primop2str_[def] = str;
+        primop2str_[def] = std::move(str);
     else
-        def2str_[def] = str;
+        def2str_[def] = std::move(str);
 }
 
 bool CCodeGen::is_texture_type(const Type* type) {
@@ -1514,10 +2072,40 @@ std::string CCodeGen::type_name(const Type* type) {
     return make_identifier(std::string(os.str()));
 }
 
+const Type* CCodeGen::tuple_type(ArrayRef<const Type*> ops) {
+    // functions are emitted in parallel but share the type table of the world
+    std::lock_guard<std::mutex> lock(parent_ ? parent_->world_mutex_ : world_mutex_);
+    return world_.tuple_type(ops);
+}
+
 std::string CCodeGen::array_name(const DefiniteArrayType* array_type) {
     return "array_" + std::to_string(array_type->dim()) + "_" + type_name(array_type->elem_type());
 }
 
+std::string CCodeGen::vector_name(const PrimType* primtype) {
+    auto length = primtype->length();
+    if ((lang_ == Lang::CUDA && (length < 2 || length > 4))
+        || (lang_ == Lang::OPENCL && length != 2 && length != 3 && length != 4 && length != 8 && length != 16))
+        ELOG("{}: there is no built-in vector type with {} elements", get_lang(), length);
+
+    std::string name;
+    switch (primtype->primtype_tag()) {
+        case PrimType_bool:                     name = "int";                    break; // see vector_elem_type
+        case PrimType_ps8:  case PrimType_qs8:  name = "char";                   break;
+        case PrimType_pu8:  case PrimType_qu8:  name = "uchar";                  break;
+        case PrimType_ps16: case PrimType_qs16: name = "short";                  break;
+        case PrimType_pu16: case PrimType_qu16: name = "ushort";                 break;
+        case PrimType_ps32: case PrimType_qs32: name = "int";                    break;
+        case PrimType_pu32: case PrimType_qu32: name = "uint";                   break;
+        case PrimType_ps64: case PrimType_qs64: name = "long";                   break;
+        case PrimType_pu64: case PrimType_qu64: name = "ulong";                  break;
+        case PrimType_pf16: case PrimType_qf16: name = "half";   use_16_ = true; break;
+        case PrimType_pf32: case PrimType_qf32: name = "float";                  break;
+        case PrimType_pf64: case PrimType_qf64: name = "double"; use_64_ = true; break;
+    }
+    return name + std::to_string(primtype->length());
+}
+
 std::string CCodeGen::tuple_name(const TupleType* tuple_type) {
     std::string name = "tuple";
     for (auto op : tuple_type->ops())
@@ -1527,8 +2115,8 @@ std::string CCodeGen::tuple_name(const TupleType* tuple_type) {
 
 //------------------------------------------------------------------------------
 
-void emit_c(World& world, const Cont2Config& kernel_config, std::ostream& stream, Lang lang, bool debug) {
-    CCodeGen(world, kernel_config, stream, lang, debug).emit();
+void emit_c(World& world, const Cont2Config& kernel_config, std::ostream& stream, Lang lang, bool debug, unsigned num_threads) {
+    CCodeGen(world, kernel_config, stream, lang, debug).emit(num_threads);
 }
 
 void emit_c_int(World& world, std::ostream& stream) {
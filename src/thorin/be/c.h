@@ -18,7 +18,8 @@ enum class Lang : uint8_t {
     OPENCL      ///< Flag for OpenCL
 };
 
-void emit_c(World&, const Cont2Config& kernel_config, std::ostream& stream, Lang lang, bool debug);
+/// Functions are emitted on @p num_threads threads, or one per core if @p num_threads is zero; the output does not depend on it.
+void emit_c(World&, const Cont2Config& kernel_config, std::ostream& stream, Lang lang, bool debug, unsigned num_threads = 0);
 void emit_c_int(World&, std::ostream& stream);
 
 }
@@ -0,0 +1,216 @@
+#include "thorin/be/hls_dataflow.h"
+
+#include "thorin/primop.h"
+#include "thorin/analyses/cfg.h"
+#include "thorin/analyses/domtree.h"
+#include "thorin/analyses/schedule.h"
+#include "thorin/analyses/scope.h"
+
+#include <algorithm>
+
+namespace thorin {
+
+HLSDataflow::HLSDataflow(const Scope& scope) {
+    if (!analyze(scope)) {
+        stages_.clear();
+        streams_.clear();
+    }
+}
+
+bool HLSDataflow::analyze(const Scope& scope) {
+    auto entry = scope.entry();
+    ParamSet buffers;
+    ContinuationSet done;
+
+    // follow the straight-line code of the kernel from pipeline to pipeline
+    for (auto continuation = entry; done.emplace(continuation).second; ) {
+        if (continuation->empty())
+            return false;
+        auto callee = continuation->callee()->isa_continuation();
+        if (callee && callee->intrinsic() == Intrinsic::Pipeline) {
+            auto ii = continuation->arg(1)->as<PrimLit>()->value().get_s32();
+            auto lower = continuation->arg(2)->isa<PrimLit>();
+            auto upper = continuation->arg(3)->isa<PrimLit>();
+            int64_t trip_count = lower && upper ? upper->value().get_s32() - lower->value().get_s32() : 0;
+            stages_.push_back({ continuation, uint64_t(std::max(ii, 1)), uint64_t(std::max(trip_count, int64_t(0))) });
+            auto next = continuation->arg(5)->isa_continuation();
+            if (!next)
+                return stages_.size() >= 2 && assign(scope, buffers);
+            continuation = next;
+        } else if (callee && callee->intrinsic() == Intrinsic::Reserve) {
+            continuation = continuation->arg(2)->as_continuation();
+            buffers.emplace(continuation->param(1));
+        } else if (callee && callee->is_basicblock() && scope.contains(callee)) {
+            continuation = callee;
+        } else if (continuation->callee() == entry->ret_param()) {
+            return stages_.size() >= 2 && assign(scope, buffers);
+        } else {
+            return false;
+        }
+    }
+    return false;
+}
+
+/**
+ * Strips LEAs and bitcasts from @p ptr and follows params of basic blocks to the pointers passed to them.
+ * Returns the buffer @p ptr points into or @c nullptr if different buffers reach a param.
+ */
+static const Def* find_buffer(const Def* ptr, ParamSet& path) {
+    while (true) {
+        if (auto lea = ptr->isa<LEA>())
+            ptr = lea->ptr();
+        else if (auto bitcast = ptr->isa<Bitcast>())
+            ptr = bitcast->from();
+        else
+            break;
+    }
+
+    auto param = ptr->isa<Param>();
+    if (!param || !param->continuation()->is_basicblock())
+        return ptr;
+    auto peeks = param->peek();
+    if (peeks.empty())
+        return ptr;
+
+    const Def* buffer = nullptr;
+    path.emplace(param);
+    for (const auto& peek : peeks) {
+        auto b = find_buffer(peek.def(), path);
+        if (b && b->isa<Param>() && path.contains(b->as<Param>()))
+            continue; // passed around a loop
+        if (!b || (buffer && b != buffer)) {
+            buffer = nullptr;
+            break;
+        }
+        buffer = b;
+    }
+    path.erase(param);
+    return buffer;
+}
+
+/// Is @p ptr used other than as address of a load or store, e.g. passed to a call or stored in memory?
+static bool escapes(const Scope& scope, const Def* ptr, DefSet& done) {
+    if (!done.emplace(ptr).second)
+        return false;
+    for (auto use : ptr->uses()) {
+        auto def = use.def();
+        if (!scope.contains(def))
+            continue;
+        if (def->isa<LEA>() || def->isa<Bitcast>()) {
+            if (escapes(scope, def, done))
+                return true;
+        } else if (auto continuation = def->isa_continuation()) {
+            auto callee = continuation->callee()->isa_continuation();
+            if (use.index() == 0 || !callee || !callee->is_basicblock() || !scope.contains(callee))
+                return true;
+            if (escapes(scope, callee->param(use.index() - 1), done))
+                return true;
+        } else if (!def->isa<Access>() || use.index() != 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HLSDataflow::assign(const Scope& scope, const ParamSet& buffers) {
+    auto& cfg = scope.f_cfg();
+    auto& post_domtree = scope.b_cfg().domtree();
+
+    // each stage consists of the blocks of its loop body
+    ContinuationMap<size_t> stage_of;
+    for (size_t i = 0, e = stages_.size(); i != e; ++i) {
+        auto pipeline = stages_[i].pipeline;
+        std::vector<const CFNode*> stack{ cfg[pipeline->arg(4)->as_continuation()] };
+        while (!stack.empty()) {
+            auto n = stack.back();
+            stack.pop_back();
+            if (n->continuation() == pipeline->arg(5) || !stage_of.emplace(n->continuation(), i).second)
+                continue;
+            for (auto succ : cfg.succs(n))
+                stack.push_back(succ);
+        }
+    }
+
+    struct Use {
+        size_t stage;
+        bool write;
+        bool sequential; ///< Accessed once per iteration at the loop counter?
+    };
+    DefMap<std::vector<Use>> uses;
+
+    Schedule schedule(scope);
+    for (auto& block : schedule) {
+        auto stage = stage_of.find(block.continuation());
+        for (auto primop : block) {
+            auto access = primop->isa<Access>();
+            if (!access)
+                continue;
+            // memory accessed outside of the pipelines serializes the stages
+            if (stage == stage_of.end())
+                return false;
+
+            auto pipeline = stages_[stage->second].pipeline;
+            auto body = pipeline->arg(4)->as_continuation();
+            auto lea = access->ptr()->isa<LEA>();
+            bool sequential = lea && lea->index() == body->param(1) && is_zero(pipeline->arg(2))
+                && post_domtree.dominates(post_domtree.cfg()[block.continuation()], post_domtree.cfg()[body]);
+            ParamSet path;
+            auto buffer = find_buffer(access->ptr(), path);
+            if (buffer == nullptr)
+                return false;
+            // pointers returned by calls or loaded from memory may alias any other buffer
+            auto param = buffer->isa<Param>();
+            if (param ? param->continuation() != scope.entry() && !buffers.contains(param) : !buffer->isa<Slot>() && !buffer->isa<Global>())
+                return false;
+            uses[buffer].push_back({ stage->second, access->isa<Store>() != nullptr, sequential });
+        }
+    }
+
+    for (const auto& p : uses) {
+        // the stages must see all accesses to a buffer
+        DefSet done;
+        if (escapes(scope, p.first, done))
+            return false;
+
+        const auto& list = p.second;
+        auto cmp = [] (const Use& a, const Use& b) { return a.stage < b.stage; };
+        auto first = std::min_element(list.begin(), list.end(), cmp)->stage;
+        auto last  = std::max_element(list.begin(), list.end(), cmp)->stage;
+
+        if (first != last) {
+            // a buffer shared by two stages must be produced by the first one and consumed by the second one
+            bool produced = false;
+            for (const auto& use : list) {
+                if ((use.stage != first && use.stage != last) || (use.stage == last && use.write))
+                    return false;
+                produced |= use.write;
+            }
+            if (!produced)
+                return false;
+        }
+
+        auto param = p.first->isa<Param>();
+        if (!param || !std::all_of(list.begin(), list.end(), [] (const Use& use) { return use.sequential; }))
+            continue;
+        if (param->continuation() == scope.entry() && list.size() == 1)
+            streams_.emplace(param);
+        if (buffers.contains(param) && list.size() == 2 && first != last
+            && stages_[first].trip_count != 0 && stages_[first].trip_count == stages_[last].trip_count)
+            streams_.emplace(param);
+    }
+
+    return true;
+}
+
+std::pair<uint64_t, uint64_t> HLSDataflow::interval() const {
+    uint64_t dataflow = 0, sequential = 0;
+    for (const auto& stage : stages_) {
+        if (stage.trip_count == 0)
+            return { 0, 0 };
+        dataflow = std::max(dataflow, stage.cycles());
+        sequential += stage.cycles();
+    }
+    return { dataflow, sequential };
+}
+
+}
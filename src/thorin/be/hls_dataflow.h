@@ -0,0 +1,51 @@
+#ifndef THORIN_BE_HLS_DATAFLOW_H
+#define THORIN_BE_HLS_DATAFLOW_H
+
+#include "thorin/continuation.h"
+
+namespace thorin {
+
+class Scope;
+
+/**
+ * Splits an HLS kernel into dataflow stages: one stage per pipelined loop in the body of the kernel.
+ * The kernel forms a dataflow region if its body is a straight sequence of at least two pipelines
+ * and every buffer is either private to one stage or produced by one stage and consumed by a later one.
+ * Buffers that are passed to calls or whose origin is not known keep the kernel from forming a region.
+ * Buffers that a stage accesses exactly once per iteration at the loop counter are streamed:
+ * kernel params become streaming interfaces and local buffers become FIFOs between the stages.
+ */
+class HLSDataflow {
+public:
+    struct Stage {
+        Continuation* pipeline; ///< The block that calls the @p Pipeline intrinsic.
+        uint64_t ii;
+        uint64_t trip_count;    ///< @c 0 if the bounds are not known at compile time.
+
+        uint64_t cycles() const { return ii * trip_count; }
+    };
+
+    explicit HLSDataflow(const Scope&);
+
+    bool empty() const { return stages_.empty(); } ///< Is the kernel no dataflow region?
+    const std::vector<Stage>& stages() const { return stages_; }
+    bool is_stream(const Param* buffer) const { return streams_.contains(buffer); }
+
+    /**
+     * Throughput model: each stage takes @p Stage::cycles and a new invocation of the kernel starts
+     * as soon as the slowest stage is done, instead of after all stages.
+     * Returns the cycles between two invocations with and without dataflow or @c 0 if some trip count is unknown.
+     */
+    std::pair<uint64_t, uint64_t> interval() const;
+
+private:
+    bool analyze(const Scope&);
+    bool assign(const Scope&, const ParamSet& buffers);
+
+    std::vector<Stage> stages_;
+    ParamSet streams_;
+};
+
+}
+
+#endif
@@ -0,0 +1,48 @@
+#include "thorin/be/kernel_config.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace thorin {
+
+bool KernelTuning::load(std::istream& is) {
+    std::string line;
+    while (std::getline(is, line)) {
+        std::istringstream iss(line);
+        std::string kernel;
+        if (!(iss >> kernel) || kernel[0] == '#')
+            continue;
+        int x, y, z;
+        if (!(iss >> x >> y >> z) || x <= 0 || y <= 0 || z <= 0)
+            return false;
+        set(kernel, BlockSize(x, y, z));
+    }
+    return true;
+}
+
+void KernelTuning::save(std::ostream& os) const {
+    for (auto& p : block_sizes_)
+        os << p.first << ' ' << std::get<0>(p.second) << ' ' << std::get<1>(p.second) << ' ' << std::get<2>(p.second) << std::endl;
+}
+
+std::vector<KernelTuning::BlockSize> KernelTuning::candidates(BlockSize block) {
+    const int max_threads = 1024;
+    std::vector<BlockSize> result;
+    int y = std::get<1>(block), z = std::max(std::get<2>(block), 1);
+    if (y <= 1) {
+        // one-dimensional blocks: multiples of the warp size
+        for (int x = 32; x * z <= max_threads; x *= 2)
+            result.emplace_back(x, 1, z);
+    } else {
+        // two-dimensional blocks: tiles between 64 and max_threads threads
+        for (int x = 8; x <= 256; x *= 2) {
+            for (int y = 1; y <= 32; y *= 2) {
+                if (x * y * z >= 64 && x * y * z <= max_threads)
+                    result.emplace_back(x, y, z);
+            }
+        }
+    }
+    return result;
+}
+
+}
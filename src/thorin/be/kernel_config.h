@@ -1,6 +1,14 @@
 #ifndef THORIN_BE_KERNEL_CONFIG_H
 #define THORIN_BE_KERNEL_CONFIG_H
 
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "thorin/continuation.h"
 #include "thorin/util/cast.h"
 #include "thorin/util/hash.h"
 
@@ -15,17 +23,53 @@ typedef ContinuationMap<std::unique_ptr<KernelConfig>> Cont2Config;
 
 class GPUKernelConfig : public KernelConfig {
 public:
-    GPUKernelConfig(std::tuple<int, int, int> block, bool has_restrict = false)
-        : block_(block), has_restrict_(has_restrict)
+    GPUKernelConfig(std::tuple<int, int, int> block, const std::vector<bool>& restrict_params = {})
+        : block_(block), restrict_params_(restrict_params)
     {}
 
     std::tuple<int, int, int> block_size() const { return block_; }
 
-    bool has_restrict() const { return has_restrict_; }
+    /// Does pointer parameter @p param of the kernel not alias any other pointer parameter that is accessed?
+    bool has_restrict(const Param* param) const {
+        return param->index() < restrict_params_.size() && restrict_params_[param->index()];
+    }
 
 private:
     std::tuple<int, int, int> block_;
-    bool has_restrict_;
+    std::vector<bool> restrict_params_; ///< Indexed by parameter, so that the configuration survives a cleanup of the kernel.
+};
+
+/**
+ * Block sizes of GPU kernels picked by the launch-configuration autotuner, keyed by kernel name.
+ * In autotuning mode, every GPU launch asks the runtime to pick one of the @p candidates for the launched kernel;
+ * the tuning driver in the runtime times the candidates and writes its choices in the format understood by @p load.
+ * Otherwise, the tuned block sizes replace the block sizes of the corresponding launches and end up in @p Cont2Config.
+ */
+class KernelTuning {
+public:
+    typedef std::tuple<int, int, int> BlockSize;
+
+    explicit KernelTuning(bool autotune = false)
+        : autotune_(autotune)
+    {}
+
+    bool autotune() const { return autotune_; }
+    const BlockSize* find(const std::string& kernel) const {
+        auto it = block_sizes_.find(kernel);
+        return it != block_sizes_.end() ? &it->second : nullptr;
+    }
+    void set(const std::string& kernel, BlockSize block) { block_sizes_[kernel] = block; }
+
+    /// Reads lines of the form <tt>kernel x y z</tt>; empty lines and lines starting with @c # are ignored.
+    bool load(std::istream&);
+    void save(std::ostream&) const;
+
+    /// Block sizes to try for a kernel that is launched with @p block; @c -1 stands for an unknown dimension.
+    static std::vector<BlockSize> candidates(BlockSize block);
+
+private:
+    bool autotune_;
+    std::map<std::string, BlockSize> block_sizes_;
 };
 
 class HLSKernelConfig : public KernelConfig {
@@ -29,6 +29,15 @@ void AMDGPUCodeGen::emit_function_decl_hook(Continuation* continuation, llvm::Fu
             annotation_values_wgsize[2] = llvm::ConstantAsMetadata::get(irbuilder_.getInt32(std::get<2>(block)));
             f->setMetadata(llvm::StringRef("reqd_work_group_size"), llvm::MDNode::get(*context_, llvm_ref(annotation_values_wgsize)));
         }
+
+        auto arg = f->arg_begin();
+        for (auto param : continuation->params()) {
+            if (is_mem(param) || is_unit(param) || param->order() != 0)
+                continue;
+            if (param->type()->isa<PtrType>() && config->second->as<GPUKernelConfig>()->has_restrict(param))
+                arg->addAttr(llvm::Attribute::NoAlias);
+            ++arg;
+        }
     }
 }
 
@@ -1,19 +1,60 @@
 #include "thorin/be/llvm/cpu.h"
 
+#include <algorithm>
 #include <cstdlib>
+#include <sstream>
 
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/IR/GlobalIFunc.h>
+#include <llvm/IR/LegacyPassManager.h>
 #include <llvm/Support/Host.h>
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "thorin/util/log.h"
 
 namespace thorin {
 
-CPUCodeGen::CPUCodeGen(World& world)
+// only features the dispatcher can test: a clone for a full CPU like haswell would also use FMA and BMI2
+enum { SSE4_2 = 1u << 8, AVX = 1u << 9, AVX2 = 1u << 10, FMA = 1u << 14, AVX512F = 1u << 15 };
+
+static const FeatureLevel feature_levels[] = {
+    { "sse4.2", "+sse4.2",  SSE4_2 },
+    { "avx2",   "+avx2",    AVX | AVX2 },
+    { "avx512", "+avx512f", AVX | AVX2 | FMA | AVX512F }, // LLVM's avx512f implies fma
+};
+
+JIT::JIT(std::unique_ptr<llvm::orc::LLJIT> jit)
+    : jit_(std::move(jit))
+{}
+
+JIT::~JIT() {}
+
+void* JIT::lookup(Continuation* continuation) {
+    assert(continuation->is_exported());
+    auto symbol = jit_->lookup(continuation->name().str());
+    if (!symbol) {
+        llvm::consumeError(symbol.takeError());
+        return nullptr;
+    }
+    return reinterpret_cast<void*>(symbol->getAddress());
+}
+
+CPUCodeGen::CPUCodeGen(World& world, bool autotune)
     : CodeGen(world, llvm::CallingConv::C, llvm::CallingConv::C, llvm::CallingConv::C)
 {
+    if (autotune)
+        runtime_->enable_autotuning();
+
     llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
     auto triple_str   = llvm::sys::getDefaultTargetTriple();
     auto cpu_str      = llvm::sys::getHostCPUName();
     std::string features_str;
@@ -25,15 +66,40 @@ CPUCodeGen::CPUCodeGen(World& world)
     char* target_triple   = std::getenv("ANYDSL_TARGET_TRIPLE");
     char* target_cpu      = std::getenv("ANYDSL_TARGET_CPU");
     char* target_features = std::getenv("ANYDSL_TARGET_FEATURES");
+    char* target_variants = std::getenv("ANYDSL_TARGET_VARIANTS");
 
     if (target_triple && target_cpu) {
         llvm::InitializeAllTargets();
         llvm::InitializeAllTargetMCs();
+        llvm::InitializeAllAsmPrinters();
         triple_str   = target_triple;
         cpu_str      = target_cpu;
         features_str = target_features ? target_features : "";
     }
 
+    if (target_variants) {
+        std::istringstream is(target_variants);
+        for (std::string name; std::getline(is, name, ',');) {
+            auto level = std::find_if(std::begin(feature_levels), std::end(feature_levels), [&] (const FeatureLevel& level) { return name == level.name; });
+            if (level == std::end(feature_levels))
+                WLOG("unknown feature level '{}' in ANYDSL_TARGET_VARIANTS", name);
+            else if (std::find(variants_.begin(), variants_.end(), level) == variants_.end())
+                variants_.push_back(level);
+        }
+        // feature_levels is ordered from the oldest to the newest level
+        std::sort(variants_.begin(), variants_.end(), [] (const FeatureLevel* a, const FeatureLevel* b) { return a > b; });
+
+        llvm::Triple triple(triple_str);
+        if (!triple.isX86() || !triple.isOSBinFormatELF()) {
+            WLOG("multiversioning is only supported on x86 ELF targets");
+            variants_.clear();
+        } else if (!variants_.empty() && !(target_triple && target_cpu)) {
+            // the baseline must run on every machine, the variants add their features per function
+            cpu_str      = "x86-64";
+            features_str = "";
+        }
+    }
+
     std::string error;
     auto target = llvm::TargetRegistry::lookupTarget(triple_str, error);
     assert(target && "can't create target for target architecture");
@@ -43,4 +109,106 @@ CPUCodeGen::CPUCodeGen(World& world)
     module_->setTargetTriple(triple_str);
 }
 
+void CPUCodeGen::optimize(int opt) {
+    // clone before optimizing, so that each variant is optimized for its own features
+    if (!variants_.empty())
+        multiversion();
+    CodeGen::optimize(opt);
+}
+
+void CPUCodeGen::multiversion() {
+    std::vector<llvm::Function*> functions;
+    for (auto& function : *module_) {
+        if (!function.isDeclaration() && function.hasExternalLinkage())
+            functions.push_back(&function);
+    }
+
+    // struct __processor_model { unsigned vendor, type, subtype; unsigned features[1]; } __cpu_model;
+    auto i32 = irbuilder_.getInt32Ty();
+    auto model_type = llvm::StructType::get(i32, i32, i32, llvm::ArrayType::get(i32, 1));
+    auto cpu_model = module_->getOrInsertGlobal("__cpu_model", model_type);
+    auto cpu_init = module_->getOrInsertFunction("__cpu_indicator_init", irbuilder_.getVoidTy());
+    // both come from the static part of libgcc/compiler-rt: the resolvers must not go through the PLT/GOT either
+    auto hide = [] (llvm::Value* value) {
+        auto global = llvm::cast<llvm::GlobalValue>(value->stripPointerCasts());
+        global->setVisibility(llvm::GlobalValue::HiddenVisibility);
+        global->setDSOLocal(true);
+    };
+    hide(cpu_model);
+    hide(cpu_init.getCallee());
+
+    for (auto function : functions) {
+        auto name = function->getName().str();
+        function->setName(name + ".default");
+        function->setLinkage(llvm::GlobalValue::InternalLinkage);
+
+        // dispatch(mask) returns the best variant for the features in mask;
+        // it is internal, since the resolver may run before the PLT is set up
+        auto fn_ptr_type = function->getType();
+        auto dispatch_type = llvm::FunctionType::get(fn_ptr_type, { i32 }, false);
+        auto dispatch = llvm::Function::Create(dispatch_type, llvm::GlobalValue::InternalLinkage, name + ".dispatch", module_.get());
+        irbuilder_.SetInsertPoint(llvm::BasicBlock::Create(*context_, "entry", dispatch));
+        auto mask = &*dispatch->arg_begin();
+        for (auto level : variants_) {
+            llvm::ValueToValueMapTy map;
+            auto variant = llvm::CloneFunction(function, map);
+            variant->setName(name + "." + level->name);
+            variant->addFnAttr("target-features", level->features);
+
+            auto supported = llvm::BasicBlock::Create(*context_, level->name, dispatch);
+            auto next = llvm::BasicBlock::Create(*context_, "next", dispatch);
+            auto bits = irbuilder_.getInt32(level->mask);
+            irbuilder_.CreateCondBr(irbuilder_.CreateICmpEQ(irbuilder_.CreateAnd(mask, bits), bits), supported, next);
+            irbuilder_.SetInsertPoint(supported);
+            irbuilder_.CreateRet(variant);
+            irbuilder_.SetInsertPoint(next);
+        }
+        irbuilder_.CreateRet(function);
+
+        // NAME_dispatch(mask) exports the choice, e.g. for an emulated feature mask
+        auto exported = llvm::Function::Create(dispatch_type, llvm::GlobalValue::ExternalLinkage, name + "_dispatch", module_.get());
+        irbuilder_.SetInsertPoint(llvm::BasicBlock::Create(*context_, "entry", exported));
+        irbuilder_.CreateRet(irbuilder_.CreateCall(dispatch, &*exported->arg_begin()));
+
+        // the resolver of the ifunc runs at load time with the features of the host
+        auto resolver = llvm::Function::Create(llvm::FunctionType::get(fn_ptr_type, false),
+                                               llvm::GlobalValue::InternalLinkage, name + "_resolver", module_.get());
+        irbuilder_.SetInsertPoint(llvm::BasicBlock::Create(*context_, "entry", resolver));
+        irbuilder_.CreateCall(cpu_init);
+        llvm::Value* features = irbuilder_.CreateLoad(irbuilder_.CreateInBoundsGEP(cpu_model, { irbuilder_.getInt32(0), irbuilder_.getInt32(3), irbuilder_.getInt32(0) }));
+        irbuilder_.CreateRet(irbuilder_.CreateCall(dispatch, features));
+
+        llvm::GlobalIFunc::create(function->getFunctionType(), function->getAddressSpace(),
+                                  llvm::GlobalValue::ExternalLinkage, name, resolver, module_.get());
+    }
+}
+
+void CPUCodeGen::emit_object(std::ostream& stream, int opt, bool debug) {
+    auto& module = emit(opt, debug);
+    llvm::SmallVector<char, 0> buffer;
+    llvm::raw_svector_ostream os(buffer);
+    llvm::legacy::PassManager pass_manager;
+    if (machine_->addPassesToEmitFile(pass_manager, os, nullptr, llvm::CGFT_ObjectFile))
+        ELOG("target machine cannot emit object files");
+    pass_manager.run(*module);
+    stream.write(buffer.data(), buffer.size());
+}
+
+std::unique_ptr<JIT> CPUCodeGen::jit(int opt, bool debug) {
+    auto& module = emit(opt, debug);
+    auto jit = llvm::orc::LLJITBuilder().create();
+    if (!jit)
+        ELOG("cannot create JIT: {}", llvm::toString(jit.takeError()));
+
+    // resolve the runtime and libc from the running process
+    auto generator = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess((*jit)->getDataLayout().getGlobalPrefix());
+    if (!generator)
+        ELOG("cannot search the running process for symbols: {}", llvm::toString(generator.takeError()));
+    (*jit)->getMainJITDylib().addGenerator(std::move(*generator));
+
+    if (auto error = (*jit)->addIRModule(llvm::orc::ThreadSafeModule(std::move(module), std::move(context_))))
+        ELOG("cannot compile module: {}", llvm::toString(std::move(error)));
+    return std::make_unique<JIT>(std::move(*jit));
+}
+
 }
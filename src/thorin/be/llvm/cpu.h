@@ -3,14 +3,54 @@
 
 #include "thorin/be/llvm/llvm.h"
 
+namespace llvm { namespace orc { class LLJIT; } }
+
 namespace thorin {
 
+/// Native code of a module that was compiled in-process by @p CPUCodeGen::jit.
+class JIT {
+public:
+    explicit JIT(std::unique_ptr<llvm::orc::LLJIT> jit);
+    ~JIT();
+
+    /// Returns the address of the exported @p continuation or @c nullptr if it is not part of the module.
+    void* lookup(Continuation* continuation);
+
+private:
+    std::unique_ptr<llvm::orc::LLJIT> jit_;
+};
+
+/// An x86 feature level that exported functions are compiled for in addition to the baseline.
+struct FeatureLevel {
+    const char* name;
+    const char* features;   ///< Target features of the clones for this level.
+    unsigned mask;          ///< Bits of all features enabled by @p features in the feature mask of @c __cpu_model of libgcc/compiler-rt.
+};
+
+/**
+ * Multiversioning: if @c ANYDSL_TARGET_VARIANTS lists feature levels (e.g. <tt>sse4.2,avx2,avx512</tt>),
+ * the module is compiled for a generic x86-64 CPU and every exported function is cloned for each level.
+ * The exported symbol becomes an ifunc whose resolver picks the best clone for the CPU at load time.
+ * As ifuncs and @c __cpu_model need an ELF target, multiversioning is disabled on other targets.
+ * The choice is made by an internal dispatch function; <tt>NAME_dispatch(mask)</tt> exports it, e.g. to test emulated feature masks.
+ */
 class CPUCodeGen : public CodeGen {
 public:
-    CPUCodeGen(World& world);
+    CPUCodeGen(World& world, bool autotune = false);
+
+    /// Emits an object file for the target machine to @p stream instead of textual IR.
+    void emit_object(std::ostream& stream, int opt, bool debug);
+    /// Compiles the module in-process for the host; the module moves into the @p JIT, so this @p CodeGen cannot be used afterwards.
+    std::unique_ptr<JIT> jit(int opt, bool debug);
 
 protected:
+    virtual void optimize(int opt) override;
     virtual std::string get_alloc_name() const override { return "anydsl_alloc"; }
+
+private:
+    void multiversion();
+
+    std::vector<const FeatureLevel*> variants_; ///< Best level first.
 };
 
 }
@@ -1,6 +1,7 @@
 #include "thorin/be/llvm/llvm.h"
 
 #include <algorithm>
+#include <chrono>
 #include <stdexcept>
 
 #include <llvm/ADT/Triple.h>
@@ -44,6 +45,7 @@
 #include "thorin/be/llvm/nvvm.h"
 #include "thorin/be/llvm/opencl.h"
 #include "thorin/transform/codegen_prepare.h"
+#include "thorin/transform/tile_shared_memory.h"
 #include "thorin/util/array.h"
 #include "thorin/util/log.h"
 
@@ -58,7 +60,7 @@ CodeGen::CodeGen(World& world, llvm::CallingConv::ID function_calling_convention
     , function_calling_convention_(function_calling_convention)
     , device_calling_convention_(device_calling_convention)
     , kernel_calling_convention_(kernel_calling_convention)
-    , runtime_(new Runtime(*context_, *module_.get(), irbuilder_))
+    , runtime_(new Runtime(*module_.get(), irbuilder_))
 {}
 
 Continuation* CodeGen::emit_intrinsic(Continuation* continuation) {
@@ -74,15 +76,12 @@ Continuation* CodeGen::emit_intrinsic(Continuation* continuation) {
         case Intrinsic::OpenCL:      return runtime_->emit_host_code(*this, Runtime::OPENCL_PLATFORM, ".cl",     continuation);
         case Intrinsic::AMDGPU:      return runtime_->emit_host_code(*this, Runtime::HSA_PLATFORM,    ".amdgpu", continuation);
         case Intrinsic::HLS:         return emit_hls(continuation);
-        case Intrinsic::Parallel:    return emit_parallel(continuation);
+        case Intrinsic::Parallel:
+        case Intrinsic::ParallelSchedule: return emit_parallel(continuation);
         case Intrinsic::Fibers:      return emit_fibers(continuation);
         case Intrinsic::Spawn:       return emit_spawn(continuation);
         case Intrinsic::Sync:        return emit_sync(continuation);
-#if THORIN_ENABLE_RV
         case Intrinsic::Vectorize:   return emit_vectorize_continuation(continuation);
-#else
-        case Intrinsic::Vectorize:   throw std::runtime_error("rebuild with RV support");
-#endif
         default: THORIN_UNREACHABLE;
     }
 }
@@ -520,7 +519,7 @@ std::unique_ptr<llvm::Module>& CodeGen::emit(int opt, bool debug) {
 #if THORIN_ENABLE_RV
     // emit vectorized code
     for (const auto& tuple : vec_todo_)
-        emit_vectorize(std::get<0>(tuple), std::get<1>(tuple), std::get<2>(tuple));
+        emit_vectorize(std::get<0>(tuple), std::get<1>(tuple), std::get<2>(tuple), std::get<3>(tuple));
     vec_todo_.clear();
 
     rv::lowerIntrinsics(*module_);
@@ -600,6 +599,9 @@ llvm::Value* CodeGen::lookup(const Def* def) {
         else {
             // we emit all Thorin constants in the entry block, since they are not part of the schedule
             if (is_const(primop)) {
+                if (auto constant = thorin::find(constants_, primop))
+                    return primops_[primop] = constant;
+
                 auto bb = irbuilder_.GetInsertBlock();
                 auto fn = bb->getParent();
                 auto& entry = fn->getEntryBlock();
@@ -610,6 +612,8 @@ llvm::Value* CodeGen::lookup(const Def* def) {
                 auto llvm_value = emit(primop);
                 irbuilder_.restoreIP(ip);
                 irbuilder_.SetCurrentDebugLocation(dbg);
+                if (auto constant = llvm::dyn_cast<llvm::Constant>(llvm_value))
+                    constants_[primop] = constant;
                 return primops_[primop] = llvm_value;
             }
 
@@ -1281,7 +1285,7 @@ llvm::GlobalVariable* CodeGen::emit_global_variable(llvm::Type* type, const std:
     return new llvm::GlobalVariable(*module_, type, false, llvm::GlobalValue::InternalLinkage, init, name, nullptr, llvm::GlobalVariable::NotThreadLocal, addr_space);
 }
 
-void CodeGen::create_loop(llvm::Value* lower, llvm::Value* upper, llvm::Value* increment, llvm::Function* entry, std::function<void(llvm::Value*)> fun) {
+llvm::BranchInst* CodeGen::create_loop(llvm::Value* lower, llvm::Value* upper, llvm::Value* increment, llvm::Function* entry, std::function<void(llvm::Value*)> fun) {
     auto head = llvm::BasicBlock::Create(*context_, "head", entry);
     auto body = llvm::BasicBlock::Create(*context_, "body", entry);
     auto exit = llvm::BasicBlock::Create(*context_, "exit", entry);
@@ -1298,10 +1302,28 @@ void CodeGen::create_loop(llvm::Value* lower, llvm::Value* upper, llvm::Value* i
     // add instructions to the loop body
     fun(loop_counter);
 
-    // inc loop counter
-    loop_counter->addIncoming(irbuilder_.CreateAdd(loop_counter, increment), body);
-    irbuilder_.CreateBr(head);
+    // inc loop counter; fun may have left us in a different block
+    loop_counter->addIncoming(irbuilder_.CreateAdd(loop_counter, increment), irbuilder_.GetInsertBlock());
+    auto latch = irbuilder_.CreateBr(head);
     irbuilder_.SetInsertPoint(exit);
+    return latch;
+}
+
+void CodeGen::enable_vectorization(llvm::BranchInst* latch, u32 width) {
+    auto true_md = llvm::ConstantAsMetadata::get(irbuilder_.getTrue());
+    llvm::Metadata* enable[] = { llvm::MDString::get(*context_, "llvm.loop.vectorize.enable"), true_md };
+    auto temp = llvm::MDNode::getTemporary(*context_, llvm::None);
+    std::vector<llvm::Metadata*> ops = { temp.get(), llvm::MDNode::get(*context_, enable) };
+    if (width != 0) {
+        llvm::Metadata* vector_width[] = {
+            llvm::MDString::get(*context_, "llvm.loop.vectorize.width"),
+            llvm::ConstantAsMetadata::get(irbuilder_.getInt32(width))
+        };
+        ops.push_back(llvm::MDNode::get(*context_, vector_width));
+    }
+    auto loop_id = llvm::MDNode::getDistinct(*context_, ops);
+    loop_id->replaceOperandWith(0, loop_id);
+    latch->setMetadata(llvm::LLVMContext::MD_loop, loop_id);
 }
 
 llvm::Value* CodeGen::create_tmp_alloca(llvm::Type* type, std::function<llvm::Value* (llvm::AllocaInst*)> fun) {
@@ -1367,6 +1389,55 @@ static const Continuation* get_alloc_call(const Def* def) {
     return call;
 }
 
+/// Collects the objects that the pointer @p def may point into; returns false if some of them are unknown.
+static bool get_pointer_roots(const Def* def, DefSet& roots, DefSet& done) {
+    if (!done.insert(def).second)
+        return true;
+
+    if (auto conv_op = def->isa<ConvOp>())
+        return get_pointer_roots(conv_op->op(0), roots, done);
+    if (auto lea = def->isa<LEA>())
+        return get_pointer_roots(lea->ptr(), roots, done);
+    if (auto select = def->isa<Select>())
+        return get_pointer_roots(select->tval(), roots, done) && get_pointer_roots(select->fval(), roots, done);
+    if (def->isa<Global>() || def->isa<Slot>()) {
+        roots.insert(def);
+        return true;
+    }
+    if (auto alloc = get_alloc_call(def)) {
+        roots.insert(alloc);
+        return true;
+    }
+    if (auto param = def->isa<Param>()) {
+        // follow the parameters of internal functions to all of their call sites
+        auto continuation = param->continuation();
+        if (!continuation->is_internal() || continuation->num_uses() == 0)
+            return false;
+        for (auto use : continuation->uses()) {
+            auto call = use->isa_continuation();
+            if (!call || use.index() != 0 || !get_pointer_roots(call->arg(param->index()), roots, done))
+                return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+/// Is the memory behind the pointer @p def only ever loaded from?
+static bool is_read_only(const Def* def) {
+    for (auto use : def->uses()) {
+        if (use->isa<Load>())
+            continue;
+        if ((use->isa<LEA>() && use.index() == 0) || use->isa<Bitcast>()) {
+            if (!is_read_only(use.def()))
+                return false;
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
 static uint64_t get_alloc_size(const Def* def) {
     auto call = get_alloc_call(def);
     if (!call) return 0;
@@ -1376,13 +1447,15 @@ static uint64_t get_alloc_size(const Def* def) {
     return size ? static_cast<uint64_t>(size->value().get_qu64()) : 0_u64;
 }
 
-Backends::Backends(World& world)
+Backends::Backends(World& world, const KernelTuning* tuning)
     : cuda(world)
     , nvvm(world)
     , opencl(world)
     , amdgpu(world)
     , hls(world)
 {
+    auto start = std::chrono::steady_clock::now();
+
     // determine different parts of the world which need to be compiled differently
     Scope::for_each(world, [&] (const Scope& scope) {
         auto continuation = scope.entry();
@@ -1415,17 +1488,52 @@ Backends::Backends(World& world)
         !nvvm.world().empty()   ||
         !opencl.world().empty() ||
         !amdgpu.world().empty()) {
-        auto get_gpu_config = [&] (Continuation* use, Continuation* /* imported */) {
-            // determine whether or not this kernel uses restrict pointers
-            bool has_restrict = true;
-            DefSet allocs;
-            for (size_t i = LaunchArgs::Num, e = use->num_args(); has_restrict && i != e; ++i) {
+        std::vector<std::pair<Continuation*, KernelTuning::BlockSize>> tuned_launches;
+        auto get_gpu_config = [&] (Continuation* use, Continuation* imported) {
+            // a pointer argument is restrict if it cannot alias any other pointer argument, unless both are only read
+            struct PtrArg {
+                const Param* param;
+                DefSet roots;
+                bool known;
+                bool read_only;
+            };
+            std::vector<PtrArg> ptr_args;
+            for (size_t i = LaunchArgs::Num, e = use->num_args(); i != e; ++i) {
                 auto arg = use->arg(i);
                 if (!arg->type()->isa<PtrType>()) continue;
-                auto alloc = get_alloc_call(arg);
-                if (!alloc) has_restrict = false;
-                auto p = allocs.insert(alloc);
-                has_restrict &= p.second;
+                // imported has type: fn (mem, fn (mem), ...)
+                auto param = imported->param(i - LaunchArgs::Num + 2);
+                PtrArg ptr_arg { param, {}, false, is_read_only(param) };
+                DefSet done;
+                ptr_arg.known = get_pointer_roots(arg, ptr_arg.roots, done);
+                ptr_args.push_back(std::move(ptr_arg));
+            }
+
+            std::vector<bool> has_restrict(imported->num_params());
+            for (auto& ptr_arg : ptr_args) {
+                bool no_alias = true;
+                for (auto& other : ptr_args) {
+                    if (&other == &ptr_arg || (ptr_arg.read_only && other.read_only))
+                        continue;
+                    if (!ptr_arg.known || !other.known) {
+                        no_alias = false;
+                        break;
+                    }
+                    for (auto root : ptr_arg.roots)
+                        no_alias &= !other.roots.contains(root);
+                }
+                if (no_alias)
+                    has_restrict[ptr_arg.param->index()] = true;
+            }
+
+            if (tuning) {
+                // the block size picked by the runtime is only known when the kernel is launched
+                if (tuning->autotune())
+                    return std::make_unique<GPUKernelConfig>(std::tuple<int, int, int> { -1, -1, -1 }, has_restrict);
+                if (auto block = tuning->find(imported->name().str())) {
+                    tuned_launches.emplace_back(use, *block);
+                    return std::make_unique<GPUKernelConfig>(*block, has_restrict);
+                }
             }
 
             auto it_config = use->arg(LaunchArgs::Config)->as<Tuple>();
@@ -1444,6 +1552,22 @@ Backends::Backends(World& world)
         get_kernel_configs(nvvm,   kernels, kernel_config, get_gpu_config);
         get_kernel_configs(opencl, kernels, kernel_config, get_gpu_config);
         get_kernel_configs(amdgpu, kernels, kernel_config, get_gpu_config);
+
+        // launch tuned kernels with the block size in their configuration
+        for (auto& p : tuned_launches) {
+            auto use = p.first;
+            auto config = use->arg(LaunchArgs::Config)->as<Tuple>();
+            int block[] = { std::get<0>(p.second), std::get<1>(p.second), std::get<2>(p.second) };
+            Array<const Def*> dims(3, [&] (size_t i) { return world.cast(config->op(i)->type(), world.literal_qs32(block[i], config->debug())); });
+            Array<const Def*> args(use->args());
+            args[LaunchArgs::Config] = world.tuple(dims, config->debug());
+            use->jump(use->callee(), args, use->jump_debug());
+        }
+
+        // stage neighbouring loads of stencil kernels in shared memory
+        if (!cuda.  world().empty()) tile_shared_memory(cuda  .world(), kernel_config);
+        if (!nvvm.  world().empty()) tile_shared_memory(nvvm  .world(), kernel_config);
+        if (!opencl.world().empty()) tile_shared_memory(opencl.world(), kernel_config);
     }
 
     // get the HLS kernel configurations
@@ -1481,13 +1605,16 @@ Backends::Backends(World& world)
         get_kernel_configs(hls, kernels, kernel_config, get_hls_config);
     }
 
-    cpu_cg = std::make_unique<CPUCodeGen>(world);
+    cpu_cg = std::make_unique<CPUCodeGen>(world, tuning && tuning->autotune());
 
     if (!cuda.  world().empty()) cuda_cg   = std::make_unique<CUDACodeGen  >(cuda  .world(), kernel_config);
     if (!nvvm.  world().empty()) nvvm_cg   = std::make_unique<NVVMCodeGen  >(nvvm  .world(), kernel_config);
     if (!opencl.world().empty()) opencl_cg = std::make_unique<OpenCLCodeGen>(opencl.world(), kernel_config);
     if (!amdgpu.world().empty()) amdgpu_cg = std::make_unique<AMDGPUCodeGen>(amdgpu.world(), kernel_config);
     if (!hls.   world().empty()) hls_cg    = std::make_unique<HLSCodeGen   >(hls   .world(), kernel_config);
+
+    auto time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    VLOG("set up backends in {} us", time.count());
 }
 
 //------------------------------------------------------------------------------
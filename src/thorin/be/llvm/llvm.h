@@ -73,10 +73,13 @@ private:
     llvm::Value* emit_bitcast(const Def*, const Type*);
     virtual Continuation* emit_reserve(const Continuation*);
     void emit_result_phi(const Param*, llvm::Value*);
-    void emit_vectorize(u32, llvm::Function*, llvm::CallInst*);
+    void emit_vectorize(u32, llvm::Function*, llvm::CallInst*, const std::vector<unsigned>&);
+    unsigned infer_alignment(const Def*);
 
 protected:
-    void create_loop(llvm::Value*, llvm::Value*, llvm::Value*, llvm::Function*, std::function<void(llvm::Value*)>);
+    llvm::BranchInst* create_loop(llvm::Value*, llvm::Value*, llvm::Value*, llvm::Function*, std::function<void(llvm::Value*)>);
+    /// Attaches loop metadata to the back edge @p latch that asks LLVM to vectorize the loop, with the given @p width if non-zero.
+    void enable_vectorization(llvm::BranchInst* latch, u32 width = 0);
     llvm::Value* create_tmp_alloca(llvm::Type*, std::function<llvm::Value* (llvm::AllocaInst*)>);
 
     World& world_;
@@ -91,10 +94,11 @@ protected:
     ParamMap<llvm::Value*> params_;
     ParamMap<llvm::PHINode*> phis_;
     PrimOpMap<llvm::Value*> primops_;
+    PrimOpMap<llvm::Constant*> constants_; ///< Constants are shared by all functions of the module.
     ContinuationMap<llvm::Function*> fcts_;
     TypeMap<llvm::Type*> types_;
 #if THORIN_ENABLE_RV
-    std::vector<std::tuple<u32, llvm::Function*, llvm::CallInst*>> vec_todo_;
+    std::vector<std::tuple<u32, llvm::Function*, llvm::CallInst*, std::vector<unsigned>>> vec_todo_;
 #endif
 
     std::unique_ptr<Runtime> runtime_;
@@ -109,7 +113,8 @@ template<class T>
 llvm::ArrayRef<T> llvm_ref(const Array<T>& array) { return llvm::ArrayRef<T>(array.begin(), array.end()); }
 
 struct Backends {
-    Backends(World& world);
+    /// Kernel launches use the block sizes in @p tuning, or let the runtime tune them in autotuning mode.
+    Backends(World& world, const KernelTuning* tuning = nullptr);
 
     Cont2Config kernel_config;
     std::vector<Continuation*> kernels;
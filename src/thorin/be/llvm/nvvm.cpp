@@ -88,18 +88,23 @@ void NVVMCodeGen::emit_function_decl_hook(Continuation* continuation, llvm::Func
         }
     }
 
-    // check signature for texturing memory
+    // check signature for texturing memory and restrict pointers
+    auto arg = f->arg_begin();
     for (auto param : continuation->params()) {
+        if (is_mem(param) || is_unit(param) || param->order() != 0)
+            continue;
         if (auto ptr = param->type()->isa<PtrType>()) {
             switch (ptr->addr_space()) {
                 case AddrSpace::Texture:
                     emit_texture_kernel_arg(param);
-                    break;
+                    continue;
                 default:
-                    // ignore this address space
+                    if (config != kernel_config_.end() && config->second->as<GPUKernelConfig>()->has_restrict(param))
+                        arg->addAttr(llvm::Attribute::NoAlias);
                     break;
             }
         }
+        ++arg;
     }
 }
 
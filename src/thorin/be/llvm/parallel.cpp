@@ -2,6 +2,13 @@
 
 namespace thorin {
 
+/// The closure passed to a wrapper is private to it and only read.
+static void mark_closure_arg(llvm::Function* wrapper) {
+    wrapper->addParamAttr(0, llvm::Attribute::NoAlias);
+    wrapper->addParamAttr(0, llvm::Attribute::NoCapture);
+    wrapper->addParamAttr(0, llvm::Attribute::ReadOnly);
+}
+
 enum {
     PAR_ARG_MEM,
     PAR_ARG_NUMTHREADS,
@@ -12,32 +19,48 @@ enum {
     PAR_NUM_ARGS
 };
 
+enum {
+    PAR_SCHED_ARG_MEM,
+    PAR_SCHED_ARG_NUMTHREADS,
+    PAR_SCHED_ARG_LOWER,
+    PAR_SCHED_ARG_UPPER,
+    PAR_SCHED_ARG_GRAIN,
+    PAR_SCHED_ARG_SCHEDULE,
+    PAR_SCHED_ARG_BODY,
+    PAR_SCHED_ARG_RETURN,
+    PAR_SCHED_NUM_ARGS
+};
+
 Continuation* CodeGen::emit_parallel(Continuation* continuation) {
     // arguments
-    assert(continuation->num_args() >= PAR_NUM_ARGS && "required arguments are missing");
+    bool scheduled = continuation->callee()->as_continuation()->intrinsic() == Intrinsic::ParallelSchedule;
+    size_t num_args = scheduled ? size_t(PAR_SCHED_NUM_ARGS) : size_t(PAR_NUM_ARGS);
+    size_t arg_body = scheduled ? size_t(PAR_SCHED_ARG_BODY) : size_t(PAR_ARG_BODY);
+    size_t arg_return = scheduled ? size_t(PAR_SCHED_ARG_RETURN) : size_t(PAR_ARG_RETURN);
+    assert(continuation->num_args() >= num_args && "required arguments are missing");
     auto num_threads = lookup(continuation->arg(PAR_ARG_NUMTHREADS));
     auto lower = lookup(continuation->arg(PAR_ARG_LOWER));
     auto upper = lookup(continuation->arg(PAR_ARG_UPPER));
-    auto kernel = continuation->arg(PAR_ARG_BODY)->as<Global>()->init()->as_continuation();
+    auto kernel = continuation->arg(arg_body)->as<Global>()->init()->as_continuation();
 
-    const size_t num_kernel_args = continuation->num_args() - PAR_NUM_ARGS;
+    const size_t num_kernel_args = continuation->num_args() - num_args;
 
     // build parallel-function signature
     Array<llvm::Type*> par_args(num_kernel_args + 1);
     par_args[0] = irbuilder_.getInt32Ty(); // loop index
     for (size_t i = 0; i < num_kernel_args; ++i) {
-        auto type = continuation->arg(i + PAR_NUM_ARGS)->type();
+        auto type = continuation->arg(i + num_args)->type();
         par_args[i + 1] = convert(type);
     }
 
     // fetch values and create a unified struct which contains all values (closure)
-    auto closure_type = convert(world_.tuple_type(continuation->arg_fn_type()->ops().skip_front(PAR_NUM_ARGS)));
+    auto closure_type = convert(world_.tuple_type(continuation->arg_fn_type()->ops().skip_front(num_args)));
     llvm::Value* closure = llvm::UndefValue::get(closure_type);
     if (num_kernel_args != 1) {
         for (size_t i = 0; i < num_kernel_args; ++i)
-            closure = irbuilder_.CreateInsertValue(closure, lookup(continuation->arg(i + PAR_NUM_ARGS)), unsigned(i));
+            closure = irbuilder_.CreateInsertValue(closure, lookup(continuation->arg(i + num_args)), unsigned(i));
     } else {
-        closure = lookup(continuation->arg(PAR_NUM_ARGS));
+        closure = lookup(continuation->arg(num_args));
     }
 
     // allocate closure object and write values into it
@@ -50,7 +73,16 @@ Continuation* CodeGen::emit_parallel(Continuation* continuation) {
     auto wrapper_ft = llvm::FunctionType::get(irbuilder_.getVoidTy(), wrapper_arg_types, false);
     auto wrapper_name = kernel->unique_name() + "_parallel_for";
     auto wrapper = (llvm::Function*)module_->getOrInsertFunction(wrapper_name, wrapper_ft).getCallee()->stripPointerCasts();
-    runtime_->parallel_for(num_threads, lower, upper, ptr, wrapper);
+    mark_closure_arg(wrapper);
+    llvm::ConstantInt* grain = nullptr;
+    if (scheduled) {
+        auto grain_size = lookup(continuation->arg(PAR_SCHED_ARG_GRAIN));
+        auto schedule = lookup(continuation->arg(PAR_SCHED_ARG_SCHEDULE));
+        runtime_->parallel_for(num_threads, lower, upper, grain_size, schedule, ptr, wrapper);
+        grain = llvm::dyn_cast<llvm::ConstantInt>(grain_size);
+    } else {
+        runtime_->parallel_for(num_threads, lower, upper, ptr, wrapper);
+    }
 
     // set insert point to the wrapper function
     auto old_bb = irbuilder_.GetInsertBlock();
@@ -69,24 +101,39 @@ Continuation* CodeGen::emit_parallel(Continuation* continuation) {
         target_args[1] = val;
     }
 
+    // the body is inlined into the wrapper so that the loop below can be vectorized
+    auto par_type = llvm::FunctionType::get(irbuilder_.getVoidTy(), llvm_ref(par_args), false);
+    auto kernel_par_func = (llvm::Function*)module_->getOrInsertFunction(kernel->unique_name(), par_type).getCallee()->stripPointerCasts();
+    kernel_par_func->addFnAttr(llvm::Attribute::AlwaysInline);
+
     // create loop iterating over range:
     // for (int i=lower; i<upper; ++i)
     //   body(i, <closure_elems>);
     auto wrapper_lower = &*(++wrapper_args);
     auto wrapper_upper = &*(++wrapper_args);
-    create_loop(wrapper_lower, wrapper_upper, irbuilder_.getInt32(1), wrapper, [&](llvm::Value* counter) {
-        // call kernel body
+    auto emit_body = [&](llvm::Value* counter) {
         target_args[0] = counter; // loop index
-        auto par_type = llvm::FunctionType::get(irbuilder_.getVoidTy(), llvm_ref(par_args), false);
-        auto kernel_par_func = (llvm::Function*)module_->getOrInsertFunction(kernel->unique_name(), par_type).getCallee()->stripPointerCasts();
         irbuilder_.CreateCall(kernel_par_func, target_args);
-    });
+    };
+    if (grain && grain->getSExtValue() > 1) {
+        // with a constant grain size, split the range into chunks with a constant trip count:
+        // for (int c=lower; c<upper; c+=grain)
+        //   for (int i=c; i<min(c+grain, upper); ++i)
+        //     body(i, <closure_elems>);
+        create_loop(wrapper_lower, wrapper_upper, grain, wrapper, [&](llvm::Value* chunk) {
+            auto is_last = irbuilder_.CreateICmpSLT(irbuilder_.CreateSub(wrapper_upper, chunk), grain);
+            auto chunk_end = irbuilder_.CreateSelect(is_last, wrapper_upper, irbuilder_.CreateAdd(chunk, grain));
+            enable_vectorization(create_loop(chunk, chunk_end, irbuilder_.getInt32(1), wrapper, emit_body));
+        });
+    } else {
+        enable_vectorization(create_loop(wrapper_lower, wrapper_upper, irbuilder_.getInt32(1), wrapper, emit_body));
+    }
     irbuilder_.CreateRetVoid();
 
     // restore old insert point
     irbuilder_.SetInsertPoint(old_bb);
 
-    return continuation->arg(PAR_ARG_RETURN)->as_continuation();
+    return continuation->arg(arg_return)->as_continuation();
 }
 
 enum {
@@ -138,6 +185,7 @@ Continuation* CodeGen::emit_fibers(Continuation* continuation) {
     auto wrapper_ft = llvm::FunctionType::get(irbuilder_.getVoidTy(), wrapper_arg_types, false);
     auto wrapper_name = kernel->unique_name() + "_fibers";
     auto wrapper = (llvm::Function*)module_->getOrInsertFunction(wrapper_name, wrapper_ft).getCallee()->stripPointerCasts();
+    mark_closure_arg(wrapper);
     runtime_->spawn_fibers(num_threads, num_blocks, num_warps, ptr, wrapper);
 
     // set insert point to the wrapper function
@@ -163,9 +211,10 @@ Continuation* CodeGen::emit_fibers(Continuation* continuation) {
     target_args[0] = wrapper_block;
     target_args[1] = wrapper_warp;
 
-    // call kernel body
+    // call kernel body, which is inlined into the wrapper
     auto fib_type = llvm::FunctionType::get(irbuilder_.getVoidTy(), llvm_ref(fib_args), false);
     auto kernel_fib_func = (llvm::Function*)module_->getOrInsertFunction(kernel->unique_name(), fib_type).getCallee()->stripPointerCasts();
+    kernel_fib_func->addFnAttr(llvm::Attribute::AlwaysInline);
     irbuilder_.CreateCall(kernel_fib_func, target_args);
     irbuilder_.CreateRetVoid();
 
@@ -215,6 +264,7 @@ Continuation* CodeGen::emit_spawn(Continuation* continuation) {
     auto wrapper_ft = llvm::FunctionType::get(irbuilder_.getVoidTy(), wrapper_arg_types, false);
     auto wrapper_name = kernel->unique_name() + "_spawn_thread";
     auto wrapper = (llvm::Function*)module_->getOrInsertFunction(wrapper_name, wrapper_ft).getCallee()->stripPointerCasts();
+    mark_closure_arg(wrapper);
     auto call = runtime_->spawn_thread(ptr, wrapper);
 
     // set insert point to the wrapper function
@@ -234,9 +284,10 @@ Continuation* CodeGen::emit_spawn(Continuation* continuation) {
         target_args[0] = val;
     }
 
-    // call kernel body
+    // call kernel body, which is inlined into the wrapper
     auto par_type = llvm::FunctionType::get(irbuilder_.getVoidTy(), llvm_ref(par_args), false);
     auto kernel_par_func = (llvm::Function*)module_->getOrInsertFunction(kernel->unique_name(), par_type).getCallee()->stripPointerCasts();
+    kernel_par_func->addFnAttr(llvm::Attribute::AlwaysInline);
     irbuilder_.CreateCall(kernel_par_func, target_args);
     irbuilder_.CreateRetVoid();
 
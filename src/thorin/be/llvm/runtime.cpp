@@ -1,13 +1,12 @@
 #include "thorin/be/llvm/runtime.h"
 
+#include <algorithm>
+#include <cstring>
 #include <sstream>
-#include <stdexcept>
 
-#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Type.h>
-#include <llvm/IRReader/IRReader.h>
-#include <llvm/Support/SourceMgr.h>
 
 #include "thorin/primop.h"
 #include "thorin/util/log.h"
@@ -16,24 +15,45 @@
 
 namespace thorin {
 
-Runtime::Runtime(llvm::LLVMContext& context,
-                 llvm::Module& target,
+Runtime::Runtime(llvm::Module& target,
                  llvm::IRBuilder<>& builder)
     : target_(target)
     , builder_(builder)
     , layout_(target.getDataLayout())
-{
-    llvm::SMDiagnostic diag;
-    auto mem_buf = llvm::MemoryBuffer::getMemBuffer(runtime_definitions);
-    runtime_ = llvm::parseIR(*mem_buf.get(), diag, context);
-    if (runtime_ == nullptr)
-        throw std::logic_error("runtime could not be loaded");
+{}
+
+static llvm::Type* runtime_type(llvm::LLVMContext& context, char c) {
+    auto closure = [&] { return llvm::StructType::get(llvm::Type::getInt8PtrTy(context), llvm::Type::getInt64Ty(context)); };
+    switch (c) {
+        case 'v': return llvm::Type::getVoidTy(context);
+        case 'i': return llvm::Type::getInt32Ty(context);
+        case 'l': return llvm::Type::getInt64Ty(context);
+        case 'b': return llvm::Type::getInt8PtrTy(context);
+        case 'p': return llvm::Type::getInt32PtrTy(context);
+        case 'a': return llvm::Type::getInt8PtrTy(context)->getPointerTo();
+        case 'A': return llvm::ArrayType::get(llvm::Type::getInt8Ty(context), 0)->getPointerTo();
+        case 'c': return closure();
+        case 'C': return closure()->getPointerTo();
+        default: THORIN_UNREACHABLE;
+    }
 }
 
 llvm::Function* Runtime::get(const char* name) {
-    auto result = llvm::cast<llvm::Function>(target_.getOrInsertFunction(name, runtime_->getFunction(name)->getFunctionType()).getCallee()->stripPointerCasts());
-    assert(result != nullptr && "Required runtime function could not be resolved");
-    return result;
+    if (auto function = target_.getFunction(name))
+        return function;
+
+    // build the declaration from its signature instead of parsing the runtime declarations for every module
+    auto definition = std::find_if(std::begin(runtime_definitions), std::end(runtime_definitions),
+        [&] (const std::pair<const char*, const char*>& definition) { return std::strcmp(definition.first, name) == 0; });
+    assert(definition != std::end(runtime_definitions) && "Required runtime function could not be resolved");
+
+    auto& context = target_.getContext();
+    auto signature = definition->second;
+    std::vector<llvm::Type*> param_types;
+    for (auto c = signature + 1; *c; ++c)
+        param_types.push_back(runtime_type(context, *c));
+    auto fn_type = llvm::FunctionType::get(runtime_type(context, *signature), param_types, false);
+    return llvm::cast<llvm::Function>(target_.getOrInsertFunction(name, fn_type).getCallee()->stripPointerCasts());
 }
 
 static bool contains_ptrtype(const Type* type) {
@@ -81,32 +101,25 @@ Continuation* Runtime::emit_host_code(CodeGen& code_gen, Platform platform, cons
     auto file_name = builder_.CreateGlobalStringPtr(world.name() + ext);
     const size_t num_kernel_args = continuation->num_args() - LaunchArgs::Num;
 
-    // allocate argument pointers, sizes, and types
-    llvm::Value* args   = code_gen.emit_alloca(llvm::ArrayType::get(builder_.getInt8PtrTy(), num_kernel_args), "args");
-    llvm::Value* sizes  = code_gen.emit_alloca(llvm::ArrayType::get(builder_.getInt32Ty(),   num_kernel_args), "sizes");
-    llvm::Value* aligns = code_gen.emit_alloca(llvm::ArrayType::get(builder_.getInt32Ty(),   num_kernel_args), "aligns");
-    llvm::Value* allocs = code_gen.emit_alloca(llvm::ArrayType::get(builder_.getInt32Ty(),   num_kernel_args), "allocs");
-    llvm::Value* types  = code_gen.emit_alloca(llvm::ArrayType::get(builder_.getInt8Ty(),    num_kernel_args), "types");
-
-    // fill array of arguments
+    // all argument values are stored in a single buffer; only the argument pointers are computed at runtime
+    std::vector<llvm::Type*> arg_types(num_kernel_args);
+    std::vector<llvm::Value*> arg_vals(num_kernel_args);
+    std::vector<uint32_t> arg_sizes(num_kernel_args), arg_aligns(num_kernel_args), arg_allocs(num_kernel_args);
+    std::vector<uint8_t> arg_kinds(num_kernel_args);
     for (size_t i = 0; i < num_kernel_args; ++i) {
         auto target_arg = continuation->arg(i + LaunchArgs::Num);
         const auto target_val = code_gen.lookup(target_arg);
 
         KernelArgType arg_type;
-        llvm::Value*  void_ptr;
         if (target_arg->type()->isa<DefiniteArrayType>() ||
             target_arg->type()->isa<StructType>() ||
             target_arg->type()->isa<TupleType>()) {
             // definite array | struct | tuple
-            auto alloca = code_gen.emit_alloca(target_val->getType(), target_arg->name().str());
-            builder_.CreateStore(target_val, alloca);
-
             // check if argument type contains pointers
             if (!contains_ptrtype(target_arg->type()))
                 WDEF(target_arg, "argument '{}' of aggregate type '{}' contains pointer (not supported in OpenCL 1.2)", target_arg, target_arg->type());
 
-            void_ptr = builder_.CreatePointerCast(alloca, builder_.getInt8PtrTy());
+            arg_vals[i] = target_val;
             arg_type = KernelArgType::Struct;
         } else if (target_arg->type()->isa<PtrType>()) {
             auto ptr = target_arg->type()->as<PtrType>();
@@ -115,26 +128,14 @@ Continuation* Runtime::emit_host_code(CodeGen& code_gen, Platform platform, cons
             if (!rtype->isa<ArrayType>())
                 EDEF(target_arg, "currently only pointers to arrays supported as kernel argument; argument has different type: {}", ptr);
 
-            auto alloca = code_gen.emit_alloca(builder_.getInt8PtrTy(), target_arg->name().str());
-            auto target_ptr = builder_.CreatePointerCast(target_val, builder_.getInt8PtrTy());
-            builder_.CreateStore(target_ptr, alloca);
-            void_ptr = builder_.CreatePointerCast(alloca, builder_.getInt8PtrTy());
+            arg_vals[i] = builder_.CreatePointerCast(target_val, builder_.getInt8PtrTy());
             arg_type = KernelArgType::Ptr;
         } else {
             // normal variable
-            auto alloca = code_gen.emit_alloca(target_val->getType(), target_arg->name().str());
-            builder_.CreateStore(target_val, alloca);
-
-            void_ptr = builder_.CreatePointerCast(alloca, builder_.getInt8PtrTy());
+            arg_vals[i] = target_val;
             arg_type = KernelArgType::Val;
         }
 
-        auto arg_ptr   = builder_.CreateInBoundsGEP(args,   llvm::ArrayRef<llvm::Value*>{builder_.getInt32(0), builder_.getInt32(i)});
-        auto size_ptr  = builder_.CreateInBoundsGEP(sizes,  llvm::ArrayRef<llvm::Value*>{builder_.getInt32(0), builder_.getInt32(i)});
-        auto align_ptr = builder_.CreateInBoundsGEP(aligns, llvm::ArrayRef<llvm::Value*>{builder_.getInt32(0), builder_.getInt32(i)});
-        auto alloc_ptr = builder_.CreateInBoundsGEP(allocs, llvm::ArrayRef<llvm::Value*>{builder_.getInt32(0), builder_.getInt32(i)});
-        auto type_ptr  = builder_.CreateInBoundsGEP(types,  llvm::ArrayRef<llvm::Value*>{builder_.getInt32(0), builder_.getInt32(i)});
-
         auto size = layout_.getTypeStoreSize(target_val->getType()).getFixedSize();
         if (auto struct_type = llvm::dyn_cast<llvm::StructType>(target_val->getType())) {
             // In the case of a structure, do not include the padding at the end in the size
@@ -143,32 +144,69 @@ Continuation* Runtime::emit_host_code(CodeGen& code_gen, Platform platform, cons
             size = last_offset + layout_.getTypeStoreSize(struct_type->getStructElementType(last_elem)).getFixedSize();
         }
 
-        builder_.CreateStore(void_ptr, arg_ptr);
-        builder_.CreateStore(builder_.getInt32(size), size_ptr);
-        builder_.CreateStore(builder_.getInt32(layout_.getABITypeAlignment(target_val->getType())), align_ptr);
-        builder_.CreateStore(builder_.getInt32(layout_.getTypeAllocSize(target_val->getType())), alloc_ptr);
-        builder_.CreateStore(builder_.getInt8((uint8_t)arg_type), type_ptr);
+        arg_types[i]  = arg_vals[i]->getType();
+        arg_sizes[i]  = size;
+        arg_aligns[i] = layout_.getABITypeAlignment(target_val->getType());
+        arg_allocs[i] = layout_.getTypeAllocSize(target_val->getType());
+        arg_kinds[i]  = (uint8_t)arg_type;
     }
 
-    // allocate arrays for the grid and block size
-    const auto get_u32 = [&](const Def* def) { return builder_.CreateSExt(code_gen.lookup(def), builder_.getInt32Ty()); };
+    llvm::Value* args = code_gen.emit_alloca(llvm::ArrayType::get(builder_.getInt8PtrTy(), num_kernel_args), "args");
+    auto buffer_type = llvm::StructType::get(target_.getContext(), arg_types);
+    llvm::Value* buffer = code_gen.emit_alloca(buffer_type, "kernel_args");
+    for (size_t i = 0; i < num_kernel_args; ++i) {
+        auto val_ptr = builder_.CreateStructGEP(buffer_type, buffer, unsigned(i));
+        auto arg_ptr = builder_.CreateInBoundsGEP(args, llvm::ArrayRef<llvm::Value*>{builder_.getInt32(0), builder_.getInt32(i)});
+        builder_.CreateStore(arg_vals[i], val_ptr);
+        builder_.CreateStore(builder_.CreatePointerCast(val_ptr, builder_.getInt8PtrTy()), arg_ptr);
+    }
 
-    llvm::Value* grid_array  = llvm::UndefValue::get(llvm::ArrayType::get(builder_.getInt32Ty(), 3));
-    grid_array = builder_.CreateInsertValue(grid_array, get_u32(world.extract(it_space, 0_u32)), 0);
-    grid_array = builder_.CreateInsertValue(grid_array, get_u32(world.extract(it_space, 1_u32)), 1);
-    grid_array = builder_.CreateInsertValue(grid_array, get_u32(world.extract(it_space, 2_u32)), 2);
-    llvm::Value* grid_size = code_gen.emit_alloca(grid_array->getType(), "");
-    builder_.CreateStore(grid_array, grid_size);
+    // sizes, alignments, and types are known at compile-time
+    llvm::Value* sizes  = constant_array(llvm::ConstantDataArray::get(target_.getContext(), arg_sizes),  "sizes");
+    llvm::Value* aligns = constant_array(llvm::ConstantDataArray::get(target_.getContext(), arg_aligns), "aligns");
+    llvm::Value* allocs = constant_array(llvm::ConstantDataArray::get(target_.getContext(), arg_allocs), "allocs");
+    llvm::Value* types  = constant_array(llvm::ConstantDataArray::get(target_.getContext(), arg_kinds),  "types");
 
-    llvm::Value* block_array = llvm::UndefValue::get(llvm::ArrayType::get(builder_.getInt32Ty(), 3));
-    block_array = builder_.CreateInsertValue(block_array, get_u32(world.extract(it_config, 0_u32)), 0);
-    block_array = builder_.CreateInsertValue(block_array, get_u32(world.extract(it_config, 1_u32)), 1);
-    block_array = builder_.CreateInsertValue(block_array, get_u32(world.extract(it_config, 2_u32)), 2);
-    llvm::Value* block_size = code_gen.emit_alloca(block_array->getType(), "");
-    builder_.CreateStore(block_array, block_size);
+    // allocate arrays for the grid and block size
+    const auto get_u32 = [&](const Def* def) { return builder_.CreateSExt(code_gen.lookup(def), builder_.getInt32Ty()); };
+    const auto get_dims = [&](const Def* def, const char* name) -> llvm::Value* {
+        llvm::Value* dims = llvm::UndefValue::get(llvm::ArrayType::get(builder_.getInt32Ty(), 3));
+        for (u32 i = 0; i < 3; ++i)
+            dims = builder_.CreateInsertValue(dims, get_u32(world.extract(def, i)), i);
+        if (auto constant = llvm::dyn_cast<llvm::Constant>(dims))
+            return constant_array(constant, name);
+        auto alloca = code_gen.emit_alloca(dims->getType(), name);
+        builder_.CreateStore(dims, alloca);
+        return alloca;
+    };
+    llvm::Value* grid_size  = get_dims(it_space,  "grid");
+    llvm::Value* block_size = get_dims(it_config, "block");
 
     std::vector<llvm::Value*> gep_first_elem{builder_.getInt32(0), builder_.getInt32(0)};
     grid_size  = builder_.CreateInBoundsGEP(grid_size,  gep_first_elem);
+
+    if (autotune_) {
+        // the runtime picks the block size from the candidates and writes it into a copy of the original one
+        KernelTuning::BlockSize block(-1, -1, -1);
+        if (auto config = it_config->isa<Tuple>()) {
+            if (auto y = config->op(1)->isa<PrimLit>()) std::get<1>(block) = y->qu32_value().data();
+            if (auto z = config->op(2)->isa<PrimLit>()) std::get<2>(block) = z->qu32_value().data();
+        }
+        std::vector<uint32_t> candidates;
+        for (auto& candidate : KernelTuning::candidates(block)) {
+            candidates.push_back(std::get<0>(candidate));
+            candidates.push_back(std::get<1>(candidate));
+            candidates.push_back(std::get<2>(candidate));
+        }
+        auto table = constant_array(llvm::ConstantDataArray::get(target_.getContext(), candidates), "block_candidates");
+        auto tuned = code_gen.emit_alloca(llvm::ArrayType::get(builder_.getInt32Ty(), 3), "tuned_block");
+        builder_.CreateStore(builder_.CreateLoad(block_size), tuned);
+        block_size = tuned;
+        tune_block_size(target_device,
+                        file_name, kernel_name,
+                        grid_size, builder_.CreateInBoundsGEP(block_size, gep_first_elem),
+                        builder_.getInt32(candidates.size() / 3), builder_.CreateInBoundsGEP(table, gep_first_elem));
+    }
     block_size = builder_.CreateInBoundsGEP(block_size, gep_first_elem);
     args       = builder_.CreateInBoundsGEP(args,       gep_first_elem);
     sizes      = builder_.CreateInBoundsGEP(sizes,      gep_first_elem);
@@ -185,6 +223,12 @@ Continuation* Runtime::emit_host_code(CodeGen& code_gen, Platform platform, cons
     return continuation->arg(LaunchArgs::Return)->as_continuation();
 }
 
+llvm::GlobalVariable* Runtime::constant_array(llvm::Constant* init, const std::string& name) {
+    auto global = new llvm::GlobalVariable(target_, init->getType(), true, llvm::GlobalValue::PrivateLinkage, init, name);
+    global->setUnnamedAddr(llvm::GlobalValue::UnnamedAddr::Global);
+    return global;
+}
+
 llvm::Value* Runtime::launch_kernel(llvm::Value* device,
                                     llvm::Value* file, llvm::Value* kernel,
                                     llvm::Value* grid, llvm::Value* block,
@@ -194,6 +238,14 @@ llvm::Value* Runtime::launch_kernel(llvm::Value* device,
     return builder_.CreateCall(get("anydsl_launch_kernel"), launch_args);
 }
 
+llvm::Value* Runtime::tune_block_size(llvm::Value* device,
+                                      llvm::Value* file, llvm::Value* kernel,
+                                      llvm::Value* grid, llvm::Value* block,
+                                      llvm::Value* num_candidates, llvm::Value* candidates) {
+    llvm::Value* tune_args[] = { device, file, kernel, grid, block, num_candidates, candidates };
+    return builder_.CreateCall(get("anydsl_tune_block_size"), tune_args);
+}
+
 llvm::Value* Runtime::parallel_for(llvm::Value* num_threads, llvm::Value* lower, llvm::Value* upper,
                                    llvm::Value* closure_ptr, llvm::Value* fun_ptr) {
     llvm::Value* parallel_args[] = {
@@ -204,6 +256,17 @@ llvm::Value* Runtime::parallel_for(llvm::Value* num_threads, llvm::Value* lower,
     return builder_.CreateCall(get("anydsl_parallel_for"), parallel_args);
 }
 
+llvm::Value* Runtime::parallel_for(llvm::Value* num_threads, llvm::Value* lower, llvm::Value* upper,
+                                   llvm::Value* grain_size, llvm::Value* schedule,
+                                   llvm::Value* closure_ptr, llvm::Value* fun_ptr) {
+    llvm::Value* parallel_args[] = {
+        num_threads, lower, upper, grain_size, schedule,
+        builder_.CreatePointerCast(closure_ptr, builder_.getInt8PtrTy()),
+        builder_.CreatePointerCast(fun_ptr, builder_.getInt8PtrTy())
+    };
+    return builder_.CreateCall(get("anydsl_parallel_for_schedule"), parallel_args);
+}
+
 llvm::Value* Runtime::spawn_fibers(llvm::Value* num_threads, llvm::Value* num_blocks, llvm::Value* num_warps,
                                    llvm::Value* closure_ptr, llvm::Value* fun_ptr) {
     llvm::Value* fibers_args[] = {
@@ -26,8 +26,7 @@ struct LaunchArgs {
 
 class Runtime {
 public:
-    Runtime(llvm::LLVMContext& context,
-            llvm::Module& target,
+    Runtime(llvm::Module& target,
             llvm::IRBuilder<>& builder);
 
     enum Platform {
@@ -44,9 +43,19 @@ public:
                                llvm::Value* args, llvm::Value* sizes, llvm::Value* aligns, llvm::Value* allocs, llvm::Value* types,
                                llvm::Value* num_args);
 
+    /// Emits a call to anydsl_tune_block_size, which overwrites @p block with one of the @p num_candidates block sizes in @p candidates.
+    llvm::Value* tune_block_size(llvm::Value* device,
+                                 llvm::Value* file, llvm::Value* kernel,
+                                 llvm::Value* grid, llvm::Value* block,
+                                 llvm::Value* num_candidates, llvm::Value* candidates);
+
     /// Emits a call to anydsl_parallel_for.
     llvm::Value* parallel_for(llvm::Value* num_threads, llvm::Value* lower, llvm::Value* upper,
                               llvm::Value* closure_ptr, llvm::Value* fun_ptr);
+    /// Emits a call to anydsl_parallel_for_schedule, which hands out chunks of @p grain_size iterations according to @p schedule.
+    llvm::Value* parallel_for(llvm::Value* num_threads, llvm::Value* lower, llvm::Value* upper,
+                              llvm::Value* grain_size, llvm::Value* schedule,
+                              llvm::Value* closure_ptr, llvm::Value* fun_ptr);
     /// Emits a call to anydsl_fibers_spawn.
     llvm::Value* spawn_fibers(llvm::Value* num_threads, llvm::Value* num_blocks, llvm::Value* num_warps,
                               llvm::Value* closure_ptr, llvm::Value* fun_ptr);
@@ -60,14 +69,21 @@ public:
                                  const std::string& ext,
                                  Continuation* continuation);
 
+    /// Declares the runtime function @p name in the target module.
     llvm::Function* get(const char* name);
 
+    /// Lets the runtime pick the block size of every kernel launch from a table of candidates.
+    void enable_autotuning() { autotune_ = true; }
+
 protected:
+    /// Emits a private constant global initialized with @p init.
+    llvm::GlobalVariable* constant_array(llvm::Constant* init, const std::string& name);
+
     llvm::Module& target_;
     llvm::IRBuilder<>& builder_;
     const llvm::DataLayout& layout_;
 
-    std::unique_ptr<llvm::Module> runtime_;
+    bool autotune_ = false;
 };
 
 }
@@ -1,8 +1,7 @@
 #include "thorin/config.h"
-
-#if THORIN_ENABLE_RV
 #include "thorin/be/llvm/llvm.h"
 
+#if THORIN_ENABLE_RV
 #include <llvm/Analysis/LoopInfo.h>
 #include <llvm/Analysis/ScalarEvolution.h>
 #include <llvm/Analysis/MemoryDependenceAnalysis.h>
@@ -31,6 +30,7 @@
 #include <rv/transform/loopExitCanonicalizer.h>
 #include <rv/passes.h>
 #include <rv/region/FunctionRegion.h>
+#endif
 
 #include "thorin/primop.h"
 #include "thorin/util/log.h"
@@ -49,6 +49,46 @@ struct VectorizeArgs {
     };
 };
 
+/**
+ * Infers the alignment in bytes of the pointer @p def from its provenance.
+ * Every pointer is at least aligned to the ABI alignment of its pointee;
+ * slots and globals as well as @p LEA%s with known offsets into them can give stronger guarantees.
+ */
+unsigned CodeGen::infer_alignment(const Def* def) {
+    auto& layout = module_->getDataLayout();
+    auto ptr_type = def->type()->as<PtrType>();
+    auto pointee = ptr_type->pointee();
+    if (auto array_type = pointee->isa<IndefiniteArrayType>())
+        pointee = array_type->elem_type();
+    auto llvm_pointee = convert(pointee);
+    unsigned align = llvm_pointee->isSized() ? unsigned(layout.getABITypeAlignment(llvm_pointee)) : 1u;
+
+    if (auto bitcast = def->isa<Bitcast>()) {
+        if (bitcast->from()->type()->isa<PtrType>())
+            align = std::max(align, infer_alignment(bitcast->from()));
+    } else if (auto lea = def->isa<LEA>()) {
+        auto base = infer_alignment(lea->ptr());
+        auto llvm_base = convert(lea->ptr_pointee());
+        uint64_t offset = 0;
+        if (auto struct_type = llvm::dyn_cast<llvm::StructType>(llvm_base)) {
+            offset = layout.getStructLayout(struct_type)->getElementOffset(primlit_value<u64>(lea->index()));
+        } else {
+            auto elem_size = layout.getTypeAllocSize(lea->ptr_pointee()->isa<ArrayType>()
+                ? convert(lea->ptr_pointee()->as<ArrayType>()->elem_type())
+                : llvm_base->getScalarType());
+            offset = lea->index()->isa<PrimLit>() ? elem_size * primlit_value<u64>(lea->index()) : elem_size;
+        }
+        align = std::max(align, unsigned(offset == 0 ? base : llvm::MinAlign(base, offset)));
+    } else if (def->isa<Slot>() || def->isa<Global>()) {
+        // slots and globals are emitted with the ABI alignment of their type
+        auto alloced = convert(ptr_type->pointee());
+        if (alloced->isSized())
+            align = std::max(align, unsigned(layout.getABITypeAlignment(alloced)));
+    }
+    return align;
+}
+
+#if THORIN_ENABLE_RV
 Continuation* CodeGen::emit_vectorize_continuation(Continuation* continuation) {
     auto target = continuation->callee()->as_continuation();
     assert_unused(target->intrinsic() == Intrinsic::Vectorize);
@@ -71,13 +111,16 @@ Continuation* CodeGen::emit_vectorize_continuation(Continuation* continuation) {
 
     // build iteration loop and wire the calls
     Array<llvm::Value*> args(num_kernel_args + 1);
+    std::vector<unsigned> alignments(num_kernel_args, 1);
     args[0] = irbuilder_.getInt32(0);
     for (size_t i = 0; i < num_kernel_args; ++i) {
         // check target type
         auto arg = continuation->arg(i + VectorizeArgs::Num);
         auto llvm_arg = lookup(arg);
-        if (arg->type()->isa<PtrType>())
+        if (arg->type()->isa<PtrType>()) {
             llvm_arg = irbuilder_.CreateBitCast(llvm_arg, simd_args[i + 1]);
+            alignments[i] = infer_alignment(arg);
+        }
         args[i + 1] = llvm_arg;
     }
     auto simd_kernel_call = irbuilder_.CreateCall(kernel_simd_func, llvm_ref(args));
@@ -85,12 +128,12 @@ Continuation* CodeGen::emit_vectorize_continuation(Continuation* continuation) {
     if (!continuation->arg(VectorizeArgs::Length)->isa<PrimLit>())
         EDEF(continuation->arg(VectorizeArgs::Length), "vector length must be known at compile-time");
     u32 vector_length_constant = continuation->arg(VectorizeArgs::Length)->as<PrimLit>()->qu32_value();
-    vec_todo_.emplace_back(vector_length_constant, emit_function_decl(kernel), simd_kernel_call);
+    vec_todo_.emplace_back(vector_length_constant, emit_function_decl(kernel), simd_kernel_call, std::move(alignments));
 
     return continuation->arg(VectorizeArgs::Return)->as_continuation();
 }
 
-void CodeGen::emit_vectorize(u32 vector_length, llvm::Function* kernel_func, llvm::CallInst* simd_kernel_call) {
+void CodeGen::emit_vectorize(u32 vector_length, llvm::Function* kernel_func, llvm::CallInst* simd_kernel_call, const std::vector<unsigned>& alignments) {
     verify();
 
     llvm::PassBuilder PB;
@@ -125,12 +168,13 @@ void CodeGen::emit_vectorize(u32 vector_length, llvm::Function* kernel_func, llv
 
     auto loop_counter_arg = kernel_func->arg_begin();
 
-    auto alignment = 1; // Be conservative and assume alignment of one byte
-    rv::VectorShape res = rv::VectorShape::uni(alignment);
+    // the loop index is contiguous across lanes, all other arguments are uniform
+    rv::VectorShape res = rv::VectorShape::uni(1);
     rv::VectorShapeVec args;
     args.push_back(rv::VectorShape::cont(vector_length));
-    for (auto it = std::next(loop_counter_arg), end = kernel_func->arg_end(); it != end; ++it) {
-        args.push_back(rv::VectorShape::uni(alignment));
+    size_t i = 0;
+    for (auto it = std::next(loop_counter_arg), end = kernel_func->arg_end(); it != end; ++it, ++i) {
+        args.push_back(rv::VectorShape::uni(i < alignments.size() ? alignments[i] : 1));
     }
 
     rv::VectorMapping target_mapping(
@@ -211,6 +255,50 @@ void CodeGen::emit_vectorize(u32 vector_length, llvm::Function* kernel_func, llv
     else
         simd_kernel_func->addFnAttr(llvm::Attribute::AlwaysInline);
 }
+#else
+/// Without RV, the body is called for each lane in a loop that is handed to LLVM's loop vectorizer.
+Continuation* CodeGen::emit_vectorize_continuation(Continuation* continuation) {
+    auto target = continuation->callee()->as_continuation();
+    assert_unused(target->intrinsic() == Intrinsic::Vectorize);
+    assert(continuation->num_args() >= VectorizeArgs::Num && "required arguments are missing");
+
+    // arguments
+    auto kernel = continuation->arg(VectorizeArgs::Body)->as<Global>()->init()->as_continuation();
+    const size_t num_kernel_args = continuation->num_args() - VectorizeArgs::Num;
 
+    if (!continuation->arg(VectorizeArgs::Length)->isa<PrimLit>())
+        EDEF(continuation->arg(VectorizeArgs::Length), "vector length must be known at compile-time");
+    u32 vector_length_constant = continuation->arg(VectorizeArgs::Length)->as<PrimLit>()->qu32_value();
+
+    // the body is inlined into the loop so that it can be vectorized
+    auto kernel_func = emit_function_decl(kernel);
+    kernel_func->addFnAttr(llvm::Attribute::AlwaysInline);
+
+    Array<llvm::Value*> args(num_kernel_args + 1);
+    for (size_t i = 0; i < num_kernel_args; ++i) {
+        // check target type
+        auto arg = continuation->arg(i + VectorizeArgs::Num);
+        auto llvm_arg = lookup(arg);
+        if (arg->type()->isa<PtrType>()) {
+            llvm_arg = irbuilder_.CreateBitCast(llvm_arg, kernel_func->getFunctionType()->getParamType(i + 1));
+            auto alignment = infer_alignment(arg);
+            if (alignment > 1)
+                irbuilder_.CreateAlignmentAssumption(module_->getDataLayout(), llvm_arg, alignment);
+        }
+        args[i + 1] = llvm_arg;
+    }
+
+    // for (int i=0; i<vector_length; ++i)
+    //   body(i, <args>);
+    auto latch = create_loop(irbuilder_.getInt32(0), irbuilder_.getInt32(vector_length_constant), irbuilder_.getInt32(1),
+                             irbuilder_.GetInsertBlock()->getParent(), [&](llvm::Value* counter) {
+        args[0] = counter; // loop index
+        irbuilder_.CreateCall(kernel_func, llvm_ref(args));
+    });
+    enable_vectorization(latch, vector_length_constant);
+
+    return continuation->arg(VectorizeArgs::Return)->as_continuation();
 }
 #endif
+
+}
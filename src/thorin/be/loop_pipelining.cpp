@@ -0,0 +1,182 @@
+#include "thorin/be/loop_pipelining.h"
+
+#include "thorin/primop.h"
+#include "thorin/analyses/alias.h"
+#include "thorin/analyses/cfg.h"
+#include "thorin/analyses/looptree.h"
+#include "thorin/analyses/schedule.h"
+#include "thorin/analyses/scope.h"
+
+#include <algorithm>
+
+namespace thorin {
+
+typedef LoopTree<true>::Node Node;
+typedef LoopTree<true>::Head Head;
+typedef LoopTree<true>::Leaf Leaf;
+
+/// Splits @p def into @p base @c + @p offset.
+static void affine(const Def* def, const Def*& base, int64_t& offset) {
+    base = def;
+    offset = 0;
+    auto arithop = def->isa<ArithOp>();
+    if (!arithop || !is_type_i(arithop->type()))
+        return;
+    if (arithop->arithop_tag() == ArithOp_add && arithop->lhs()->isa<PrimLit>()) {
+        base = arithop->rhs();
+        offset = primlit_value<int64_t>(arithop->lhs());
+    } else if (arithop->arithop_tag() == ArithOp_add && arithop->rhs()->isa<PrimLit>()) {
+        base = arithop->lhs();
+        offset = primlit_value<int64_t>(arithop->rhs());
+    } else if (arithop->arithop_tag() == ArithOp_sub && arithop->rhs()->isa<PrimLit>()) {
+        base = arithop->lhs();
+        offset = -primlit_value<int64_t>(arithop->rhs());
+    }
+}
+
+/// Number of operations on the longest path from @p load to @p def or @c -1 if @p def does not depend on @p load.
+static int latency(const Def* def, const Load* load, DefMap<int>& latencies) {
+    if (def == load)
+        return 1;
+    auto primop = def->isa<PrimOp>();
+    if (!primop)
+        return -1;
+    auto i = latencies.find(primop);
+    if (i != latencies.end())
+        return i->second;
+
+    int result = -1;
+    for (auto op : primop->ops()) {
+        auto l = latency(op, load, latencies);
+        if (l >= 0)
+            result = std::max(result, primop->isa<Extract>() ? l : l + 1);
+    }
+    return latencies[primop] = result;
+}
+
+static void collect_blocks(const Node* node, ContinuationSet& blocks) {
+    if (auto leaf = node->isa<Leaf>()) {
+        blocks.emplace(leaf->cf_node()->continuation());
+    } else {
+        for (const auto& child : node->as<Head>()->children())
+            collect_blocks(child.get(), blocks);
+    }
+}
+
+static LoopPipelining::Loop analyze(const Scope& scope, const Schedule& schedule, AliasAnalysis& alias, const Head* head) {
+    auto header = head->cf_nodes().front()->continuation();
+    if (head->num_cf_nodes() != 1)
+        return { header, 0, "several entries" };
+    for (const auto& child : head->children()) {
+        if (child->isa<Head>())
+            return { header, 0, "contains a loop" };
+    }
+
+    ContinuationSet blocks;
+    collect_blocks(head, blocks);
+    for (auto block : blocks) {
+        auto callee = block->callee()->isa_continuation();
+        if (!callee || !(callee->is_basicblock() || callee->intrinsic() == Intrinsic::Branch || callee->intrinsic() == Intrinsic::Match))
+            return { header, 0, "contains a call" };
+    }
+
+    // induction variables are incremented by the same constant on all back edges
+    ParamMap<int64_t> strides;
+    for (auto param : header->params()) {
+        if (!is_type_i(param->type()))
+            continue;
+        int64_t stride = 0;
+        for (auto pred : scope.f_cfg().preds(header)) {
+            auto from = pred->continuation();
+            if (!blocks.contains(from))
+                continue;
+            const Def* base;
+            int64_t offset;
+            affine(from->arg(param->index()), base, offset);
+            if (base != param || offset == 0 || (stride != 0 && offset != stride)) {
+                stride = 0;
+                break;
+            }
+            stride = offset;
+        }
+        if (stride != 0)
+            strides[param] = stride;
+    }
+
+    struct Ref {
+        const Access* access;
+        const Def* buffer;
+        const Def* iv;    ///< Induction variable of the index or @c nullptr if unknown.
+        int64_t offset;
+    };
+    std::vector<Ref> refs;
+    for (const auto& block : schedule) {
+        if (!blocks.contains(block.continuation()))
+            continue;
+        for (auto primop : block) {
+            auto access = primop->isa<Access>();
+            if (!access)
+                continue;
+            Ref ref{ access, access->ptr(), nullptr, 0 };
+            auto lea = access->ptr()->isa<LEA>();
+            while (lea && lea->ptr()->isa<LEA>())
+                lea = lea->ptr()->as<LEA>();
+            if (lea) {
+                ref.buffer = lea->ptr();
+                affine(lea->index(), ref.iv, ref.offset);
+                if (!ref.iv->isa<Param>() || !strides.contains(ref.iv->as<Param>()))
+                    ref.iv = nullptr;
+            }
+            refs.push_back(ref);
+        }
+    }
+
+    // a load that reads what a store wrote in an earlier iteration has to wait for that store
+    int ii = 1;
+    for (const auto& store : refs) {
+        if (!store.access->isa<Store>())
+            continue;
+        for (const auto& load : refs) {
+            // accesses through different pointers depend on each other unless they are known to be disjoint
+            if (!load.access->isa<Load>() || alias.alias(store.access->ptr(), load.access->ptr()) == AliasResult::NoAlias)
+                continue;
+            int64_t distance = 1;
+            if (load.buffer == store.buffer && store.iv && store.iv == load.iv) {
+                auto stride = strides[store.iv->as<Param>()];
+                auto delta = store.offset - load.offset;
+                if (delta % stride != 0 || delta / stride <= 0)
+                    continue;
+                distance = delta / stride;
+            }
+            DefMap<int> latencies;
+            auto l = latency(store.access->as<Store>()->val(), load.access->as<Load>(), latencies);
+            if (l >= 0)
+                ii = std::max(ii, int((l + 1 + distance - 1) / distance));
+        }
+    }
+    return { header, ii, nullptr };
+}
+
+static void collect_loops(const Scope& scope, const Schedule& schedule, AliasAnalysis& alias, const Head* head, std::vector<LoopPipelining::Loop>& loops) {
+    if (!head->is_root())
+        loops.push_back(analyze(scope, schedule, alias, head));
+    for (const auto& child : head->children()) {
+        if (auto head = child->isa<Head>())
+            collect_loops(scope, schedule, alias, head, loops);
+    }
+}
+
+LoopPipelining::LoopPipelining(const Scope& scope, const Schedule& schedule) {
+    AliasAnalysis alias;
+    collect_loops(scope, schedule, alias, scope.f_cfg().looptree().root(), loops_);
+}
+
+int LoopPipelining::ii(Continuation* header) const {
+    for (const auto& loop : loops_) {
+        if (loop.header == header)
+            return loop.ii;
+    }
+    return 0;
+}
+
+}
@@ -0,0 +1,40 @@
+#ifndef THORIN_BE_LOOP_PIPELINING_H
+#define THORIN_BE_LOOP_PIPELINING_H
+
+#include "thorin/continuation.h"
+
+namespace thorin {
+
+class Schedule;
+class Scope;
+
+/**
+ * Finds the loops of a function that can be pipelined without the @p Pipeline intrinsic.
+ * Only innermost loops with a single header and without calls are pipelined.
+ * Their initiation interval is estimated from the loop-carried dependences through memory:
+ * a load that reads what a store wrote @c d iterations earlier has to wait for the latency of the path
+ * from the load to the store, i.e. the interval is at least that latency divided by @c d.
+ * Accesses whose indices are not affine in an induction variable of the loop are assumed to depend on the previous iteration,
+ * and so are accesses through different pointers unless the @p AliasAnalysis proves them disjoint.
+ */
+class LoopPipelining {
+public:
+    struct Loop {
+        Continuation* header;
+        int ii;                 ///< @c 0 if the loop is not pipelined.
+        const char* reason;     ///< Why the loop is not pipelined.
+    };
+
+    LoopPipelining(const Scope&, const Schedule&);
+
+    const std::vector<Loop>& loops() const { return loops_; }
+    /// Initiation interval of the loop with @p header or @c 0 if it is not pipelined.
+    int ii(Continuation* header) const;
+
+private:
+    std::vector<Loop> loops_;
+};
+
+}
+
+#endif
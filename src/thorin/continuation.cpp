@@ -184,6 +184,7 @@ void Continuation::set_intrinsic() {
     else if (name() == "amdgpu")               attributes().intrinsic = Intrinsic::AMDGPU;
     else if (name() == "hls")                  attributes().intrinsic = Intrinsic::HLS;
     else if (name() == "parallel")             attributes().intrinsic = Intrinsic::Parallel;
+    else if (name() == "parallel_schedule")    attributes().intrinsic = Intrinsic::ParallelSchedule;
     else if (name() == "fibers")               attributes().intrinsic = Intrinsic::Fibers;
     else if (name() == "spawn")                attributes().intrinsic = Intrinsic::Spawn;
     else if (name() == "sync")                 attributes().intrinsic = Intrinsic::Sync;
@@ -81,6 +81,7 @@ enum class Intrinsic : uint8_t {
     AMDGPU,                     ///< Internal AMDGPU-Backend.
     HLS,                        ///< Internal HLS-Backend.
     Parallel,                   ///< Internal Parallel-CPU-Backend.
+    ParallelSchedule,           ///< Internal Parallel-CPU-Backend with grain size and schedule kind (0 = static, 1 = dynamic, 2 = guided).
     Fibers,                     ///< Internal Parallel-CPU-Backend using resumable fibers.
     Spawn,                      ///< Internal Parallel-CPU-Backend.
     Sync,                       ///< Internal Parallel-CPU-Backend.
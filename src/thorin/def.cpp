@@ -2,7 +2,6 @@
 
 #include <algorithm>
 #include <iostream>
-#include <sstream>
 #include <stack>
 
 #include "thorin/continuation.h"
@@ -68,9 +67,7 @@ void Def::unset_ops() {
 }
 
 std::string Def::unique_name() const {
-    std::ostringstream oss;
-    oss << name() << '_' << gid();
-    return oss.str();
+    return name().str() + '_' + std::to_string(gid());
 }
 
 bool is_unit(const Def* def) {
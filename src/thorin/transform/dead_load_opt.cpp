@@ -1,10 +1,15 @@
 #include "thorin/primop.h"
+#include "thorin/analyses/alias.h"
 #include "thorin/analyses/cfg.h"
 #include "thorin/analyses/scope.h"
 
 namespace thorin {
 
-static void dead_load_opt(const Scope& scope) {
+static size_t num_live_uses(const Def* def) {
+    return std::count_if(def->uses().begin(), def->uses().end(), [] (Use use) { return !use->is_replaced(); });
+}
+
+static void dead_load_opt(const Scope& scope, AliasAnalysis& alias) {
     auto& world = scope.world();
     for (auto n : scope.f_cfg().post_order()) {
         auto continuation = n->continuation();
@@ -18,11 +23,33 @@ static void dead_load_opt(const Scope& scope) {
         }
 
         if (mem) {
+            // Pointers that are overwritten further down the chain before anything can read them
+            std::vector<const Def*> overwritten;
             while (true) {
                 if (auto memop = mem->isa<MemOp>()) {
+                    // Another branch may observe the memory here
+                    if (num_live_uses(memop->out_mem()) > 1)
+                        overwritten.clear();
+
                     if (memop->isa<Load>() || memop->isa<Enter>()) {
-                        if (memop->out(1)->num_uses() == 0)
+                        if (memop->out(1)->num_uses() == 0) {
                             memop->replace(world.tuple({ memop->mem(), world.bottom(memop->out(1)->type()) }));
+                        } else if (auto load = memop->isa<Load>()) {
+                            overwritten.erase(std::remove_if(overwritten.begin(), overwritten.end(), [&] (const Def* ptr) {
+                                return alias.alias(ptr, load->ptr()) != AliasResult::NoAlias;
+                            }), overwritten.end());
+                        }
+                    } else if (auto store = memop->isa<Store>()) {
+                        auto ptr = store->ptr();
+                        auto dead = std::any_of(overwritten.begin(), overwritten.end(), [&] (const Def* other) {
+                            return other->type() == ptr->type() && alias.alias(other, ptr) == AliasResult::MustAlias;
+                        });
+                        if (dead)
+                            store->replace(store->mem());
+                        else
+                            overwritten.push_back(ptr);
+                    } else if (!memop->isa<Alloc>()) {
+                        overwritten.clear();
                     }
                     mem = memop->mem();
                 } else if (auto extract = mem->isa<Extract>()) {
@@ -35,7 +62,8 @@ static void dead_load_opt(const Scope& scope) {
 }
 
 void dead_load_opt(World& world) {
-    Scope::for_each(world, [&] (const Scope& scope) { dead_load_opt(scope); });
+    AliasAnalysis alias;
+    Scope::for_each(world, [&] (const Scope& scope) { dead_load_opt(scope, alias); });
 }
 
 }
@@ -4,6 +4,12 @@
 namespace thorin {
 
 class World;
+
+/**
+ * Walks the memory chain of each basic block backwards,
+ * removes @p Load%s whose value is never used and
+ * @p Store%s that are overwritten before any aliasing @p Load can observe them.
+ */
 void dead_load_opt(World&);
 
 }
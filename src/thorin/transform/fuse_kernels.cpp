@@ -0,0 +1,481 @@
+#include "thorin/primop.h"
+#include "thorin/world.h"
+#include "thorin/analyses/cfg.h"
+#include "thorin/analyses/domtree.h"
+#include "thorin/analyses/looptree.h"
+#include "thorin/analyses/scope.h"
+#include "thorin/transform/fuse_kernels.h"
+#include "thorin/transform/mangle.h"
+#include "thorin/util/log.h"
+
+#include <algorithm>
+
+namespace thorin {
+
+// same layout as the LaunchArgs of the LLVM runtime
+enum {
+    LAUNCH_ARG_MEM,
+    LAUNCH_ARG_DEVICE,
+    LAUNCH_ARG_SPACE,
+    LAUNCH_ARG_CONFIG,
+    LAUNCH_ARG_BODY,
+    LAUNCH_ARG_RETURN,
+    LAUNCH_NUM_ARGS
+};
+
+static bool is_gpu_launch(Continuation* continuation) {
+    if (continuation->empty() || continuation->num_args() < LAUNCH_NUM_ARGS)
+        return false;
+    auto callee = continuation->callee()->isa_continuation();
+    if (!callee)
+        return false;
+    switch (callee->intrinsic()) {
+        case Intrinsic::CUDA:
+        case Intrinsic::NVVM:
+        case Intrinsic::OpenCL:
+        case Intrinsic::AMDGPU:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static Continuation* kernel_of(Continuation* launch) {
+    auto global = launch->arg(LAUNCH_ARG_BODY)->isa<Global>();
+    auto kernel = global ? global->init()->isa_continuation() : nullptr;
+    // lifted kernels take the memory, the return continuation and then one parameter per launch argument
+    if (!kernel || kernel->empty() || kernel->num_params() != 2 + launch->num_args() - LAUNCH_NUM_ARGS)
+        return nullptr;
+    return kernel;
+}
+
+/// Is @p def the result of a call to @c anydsl_alloc or @c anydsl_alloc_unified?
+static const Def* alloc_call(const Def* def) {
+    while (auto conv_op = def->isa<ConvOp>())
+        def = conv_op->op(0);
+    auto param = def->isa<Param>();
+    if (!param || param->continuation()->num_uses() != 1)
+        return nullptr;
+    auto use = *param->continuation()->uses().begin();
+    auto call = use->isa_continuation();
+    if (!call || use.index() == 0)
+        return nullptr;
+    auto callee = call->callee()->isa_continuation();
+    if (!callee || (callee->name() != "anydsl_alloc" && callee->name() != "anydsl_alloc_unified"))
+        return nullptr;
+    return call;
+}
+
+/// Position of a thread in the x dimension, @p Uniform for the same value in all threads of a one-dimensional launch.
+enum class Role { None, Local, Group, LocalSize, Global, Uniform };
+
+struct Builtin {
+    const char* name;
+    Role role;
+};
+
+/// Pure builtins; OpenCL builtins take the dimension as argument and only the first dimension varies.
+static const Builtin builtins[] = {
+    { "threadIdx_x", Role::Local }, { "threadIdx_y", Role::Uniform }, { "threadIdx_z", Role::Uniform },
+    { "blockIdx_x",  Role::Group }, { "blockIdx_y",  Role::Uniform }, { "blockIdx_z",  Role::Uniform },
+    { "blockDim_x",  Role::LocalSize }, { "blockDim_y", Role::Uniform }, { "blockDim_z", Role::Uniform },
+    { "gridDim_x",   Role::Uniform }, { "gridDim_y",   Role::Uniform }, { "gridDim_z",   Role::Uniform },
+    { "llvm.nvvm.read.ptx.sreg.tid.x",    Role::Local }, { "llvm.nvvm.read.ptx.sreg.tid.y",    Role::Uniform }, { "llvm.nvvm.read.ptx.sreg.tid.z",    Role::Uniform },
+    { "llvm.nvvm.read.ptx.sreg.ctaid.x",  Role::Group }, { "llvm.nvvm.read.ptx.sreg.ctaid.y",  Role::Uniform }, { "llvm.nvvm.read.ptx.sreg.ctaid.z",  Role::Uniform },
+    { "llvm.nvvm.read.ptx.sreg.ntid.x",   Role::LocalSize }, { "llvm.nvvm.read.ptx.sreg.ntid.y", Role::Uniform }, { "llvm.nvvm.read.ptx.sreg.ntid.z", Role::Uniform },
+    { "llvm.nvvm.read.ptx.sreg.nctaid.x", Role::Uniform }, { "llvm.nvvm.read.ptx.sreg.nctaid.y", Role::Uniform }, { "llvm.nvvm.read.ptx.sreg.nctaid.z", Role::Uniform },
+    { "get_local_id",    Role::Local },
+    { "get_group_id",    Role::Group },
+    { "get_local_size",  Role::LocalSize },
+    { "get_global_id",   Role::Global },
+    { "get_num_groups",  Role::Uniform },
+    { "get_global_size", Role::Uniform },
+};
+
+/// Does @p cast convert an integer to an integer type at least as wide?
+static bool is_widening(const Cast* cast) {
+    auto from = cast->from()->type()->isa<PrimType>();
+    auto to = cast->type()->isa<PrimType>();
+    return from && to && is_type_i(from) && is_type_i(to) && num_bits(from->primtype_tag()) <= num_bits(to->primtype_tag());
+}
+
+static const char* barriers[] = { "__syncthreads", "llvm.nvvm.barrier0", "barrier", "llvm.amdgcn.s.barrier" };
+
+/// Do grid and block of @p launch only extend in the x dimension?
+static bool is_one_dimensional(Continuation* launch) {
+    for (auto i : { LAUNCH_ARG_SPACE, LAUNCH_ARG_CONFIG }) {
+        auto tuple = launch->arg(i)->isa<Tuple>();
+        if (!tuple || tuple->num_ops() != 3 || !is_one(tuple->op(1)) || !is_one(tuple->op(2)))
+            return false;
+    }
+    return true;
+}
+
+static bool depends_on(const Def* def, const Continuation* continuation, DefSet& done) {
+    if (!done.insert(def).second)
+        return false;
+    if (auto param = def->isa<Param>())
+        return param->continuation() == continuation;
+    if (def->isa<PrimOp>()) {
+        for (auto op : def->ops()) {
+            if (depends_on(op, continuation, done))
+                return true;
+        }
+    }
+    return false;
+}
+
+class FuseKernels {
+    struct Access {
+        const Def* buffer;  ///< The launch argument, or the global, that is accessed.
+        std::string index;  ///< Key of the index expression; empty if unknown or if several threads may access the same element.
+        bool store;
+    };
+
+public:
+    FuseKernels(World& world)
+        : world_(world)
+    {}
+
+    void run() {
+        while (true) {
+            bool todo = false;
+            for (auto continuation : world_.copy_continuations()) {
+                if (is_gpu_launch(continuation) && fuse(continuation)) {
+                    todo = true;
+                    break;
+                }
+            }
+            if (!todo)
+                break;
+            world_.cleanup();
+        }
+    }
+
+private:
+    bool fuse(Continuation* launch1) {
+        // the second launch must immediately follow the first one
+        auto launch2 = launch1->arg(LAUNCH_ARG_RETURN)->isa_continuation();
+        if (!launch2 || launch2->num_uses() != 1 || launch2->num_params() != 1 || !is_gpu_launch(launch2))
+            return false;
+        auto callee1 = launch1->callee()->as_continuation();
+        auto callee2 = launch2->callee()->as_continuation();
+        if (callee1->intrinsic() != callee2->intrinsic() || launch2->arg(LAUNCH_ARG_MEM) != launch2->param(0))
+            return false;
+        for (auto i : { LAUNCH_ARG_DEVICE, LAUNCH_ARG_SPACE, LAUNCH_ARG_CONFIG }) {
+            if (launch1->arg(i) != launch2->arg(i))
+                return false;
+        }
+
+        auto kernel1 = kernel_of(launch1);
+        auto kernel2 = kernel_of(launch2);
+        if (!kernel1 || !kernel2 || kernel1 == kernel2)
+            return false;
+
+        // the arguments of the second launch have to be available at the first one
+        DefSet done;
+        for (size_t i = LAUNCH_NUM_ARGS, e = launch2->num_args(); i != e; ++i) {
+            if (depends_on(launch2->arg(i), launch2, done))
+                return false;
+        }
+
+        std::vector<Access> accesses1, accesses2;
+        one_dimensional_ = is_one_dimensional(launch1);
+        // threads that leave the first kernel early would meet the others at its barriers from within the second kernel
+        if (!collect_accesses(launch1, kernel1, accesses1, true) || !collect_accesses(launch2, kernel2, accesses2, false))
+            return false;
+        if (!independent(accesses1, accesses2) || !independent(accesses2, accesses1))
+            return false;
+
+        DLOG("fusing kernels {} and {}", kernel1, kernel2);
+
+        // fused(mem, ret, args1..., args2...) where arguments passed to both kernels only appear once
+        std::vector<const Def*> args(launch1->args().begin() + LAUNCH_NUM_ARGS, launch1->args().end());
+        std::vector<size_t> index2;
+        for (size_t i = LAUNCH_NUM_ARGS, e = launch2->num_args(); i != e; ++i) {
+            auto arg = launch2->arg(i);
+            auto it = std::find(args.begin(), args.end(), arg);
+            index2.push_back(it - args.begin());
+            if (it == args.end())
+                args.push_back(arg);
+        }
+
+        std::vector<const Type*> param_types = { world_.mem_type(), world_.fn_type({ world_.mem_type() }) };
+        for (auto arg : args)
+            param_types.push_back(arg->type());
+        auto fused = world_.continuation(world_.fn_type(param_types), Debug(kernel1->name().str() + "_" + kernel2->name().str()));
+        auto between = world_.continuation(world_.fn_type({ world_.mem_type() }), kernel2->debug());
+
+        Array<const Def*> drop1(kernel1->num_params());
+        drop1[1] = between;
+        for (size_t i = 2, e = kernel1->num_params(); i != e; ++i)
+            drop1[i] = fused->param(i);
+        auto body1 = drop(Scope(kernel1), drop1);
+        fused->jump(body1, { fused->param(0) });
+
+        Array<const Def*> drop2(kernel2->num_params());
+        drop2[1] = fused->param(1);
+        for (size_t i = 2, e = kernel2->num_params(); i != e; ++i)
+            drop2[i] = fused->param(2 + index2[i - 2]);
+        auto body2 = drop(Scope(kernel2), drop2);
+        between->jump(body2, { between->param(0) });
+
+        // launch the fused kernel and continue after the second launch
+        std::vector<const Def*> ops = {
+            launch1->arg(LAUNCH_ARG_MEM),
+            launch1->arg(LAUNCH_ARG_DEVICE),
+            launch1->arg(LAUNCH_ARG_SPACE),
+            launch1->arg(LAUNCH_ARG_CONFIG),
+            world_.global(fused, false, fused->debug()),
+            launch2->arg(LAUNCH_ARG_RETURN)
+        };
+        ops.insert(ops.end(), args.begin(), args.end());
+        Array<const Type*> arg_types(ops.size(), [&] (size_t i) { return ops[i]->type(); });
+        auto callee = world_.continuation(world_.fn_type(arg_types), callee1->attributes(), callee1->debug());
+        launch1->jump(callee, ops, launch1->jump_debug());
+        return true;
+    }
+
+    /// Are the writes in @p accesses1 invisible to @p accesses2, except for writes to the same index by the same thread?
+    bool independent(const std::vector<Access>& accesses1, const std::vector<Access>& accesses2) {
+        for (auto& write : accesses1) {
+            if (!write.store)
+                continue;
+            for (auto& access : accesses2) {
+                if (access.buffer == write.buffer) {
+                    if (write.index.empty() || access.index != write.index)
+                        return false;
+                } else if (may_alias(access.buffer, write.buffer)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static bool may_alias(const Def* buffer1, const Def* buffer2) {
+        auto distinct = [] (const Def* def) { return def->isa<Global>() || alloc_call(def); };
+        return !distinct(buffer1) || !distinct(buffer2);
+    }
+
+    /// With @p uniform_barriers, barriers must be reached exactly once by every thread.
+    bool collect_accesses(Continuation* launch, Continuation* kernel, std::vector<Access>& accesses, bool uniform_barriers) {
+        Scope scope(kernel);
+        scope_ = &scope;
+        launch_ = launch;
+        kernel_ = kernel;
+        keys_.clear();
+
+        for (auto def : scope.defs()) {
+            if (auto access = def->isa<thorin::Access>()) {
+                if (!add_access(access->ptr(), access->isa<Store>(), accesses))
+                    return false;
+            } else if (def->isa<Assembly>()) {
+                return false;
+            } else if (auto continuation = def->isa_continuation()) {
+                if (continuation->empty() || scope.contains(continuation->callee()) || continuation->callee() == kernel->param(1))
+                    continue;
+                // only calls to intrinsics and imported functions; atomics count as stores
+                auto callee = continuation->callee()->isa_continuation();
+                if (!callee || (!callee->is_intrinsic() && !callee->is_imported()))
+                    return false;
+                if (uniform_barriers && callee->is_imported() && !is_uniform_barrier(scope, continuation))
+                    return false;
+                bool atomic = callee->intrinsic() == Intrinsic::Atomic     ||
+                              callee->intrinsic() == Intrinsic::AtomicLoad ||
+                              callee->intrinsic() == Intrinsic::AtomicStore ||
+                              callee->intrinsic() == Intrinsic::CmpXchg;
+                for (auto arg : continuation->args()) {
+                    if (arg->type()->isa<PtrType>() && (!atomic || !add_access(arg, true, accesses)))
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /// Is @p call no barrier, or one that is reached by every thread exactly once: it is on all paths through the kernel and not in a loop?
+    static bool is_uniform_barrier(const Scope& scope, Continuation* call) {
+        auto name = call->callee()->name();
+        if (std::none_of(std::begin(barriers), std::end(barriers), [&] (const char* barrier) { return name == barrier; }))
+            return true;
+        auto& post_domtree = scope.b_cfg().domtree();
+        auto& looptree = scope.f_cfg().looptree();
+        auto n = scope.f_cfg()[call];
+        auto m = post_domtree.cfg()[call];
+        return n && m && post_domtree.dominates(m, post_domtree.cfg()[scope.entry()]) && looptree[n]->parent()->is_root();
+    }
+
+    bool add_access(const Def* ptr, bool store, std::vector<Access>& accesses) {
+        std::string index;
+        // the same index in both kernels only means the same thread if no two threads access the same element
+        bool known = true, injective = false;
+        while (true) {
+            if (auto bitcast = ptr->isa<Bitcast>()) {
+                ptr = bitcast->from();
+            } else if (auto lea = ptr->isa<LEA>()) {
+                auto key = index_key(lea->index());
+                known &= !key.empty();
+                injective |= is_injective(lea->index());
+                index = key + "," + index;
+                ptr = lea->ptr();
+            } else {
+                break;
+            }
+        }
+
+        // accesses to private memory do not matter
+        if (ptr->isa<Slot>())
+            return true;
+
+        const Def* buffer = nullptr;
+        if (auto global = ptr->isa<Global>()) {
+            if (!global->is_mutable())
+                return !store;
+            buffer = global;
+        } else if (auto param = ptr->isa<Param>()) {
+            if (param->continuation() != kernel_ || param->index() < 2)
+                return false;
+            buffer = launch_->arg(LAUNCH_NUM_ARGS + param->index() - 2);
+        } else {
+            return false;
+        }
+
+        accesses.push_back({ buffer, known && injective ? index : std::string(), store });
+        return true;
+    }
+
+    /// Returns the role of the builtin whose result is @p def, looking through widening casts, or @p Role::None.
+    Role role(const Def* def) {
+        while (auto cast = def->isa<Cast>()) {
+            if (!is_widening(cast))
+                break;
+            def = cast->from();
+        }
+        auto param = def->isa<Param>();
+        if (!param || param->continuation() == kernel_ || param->continuation()->num_uses() != 1)
+            return Role::None;
+        auto use = *param->continuation()->uses().begin();
+        auto call = use->isa_continuation();
+        auto callee = call ? call->callee()->isa_continuation() : nullptr;
+        if (!callee || !callee->is_imported() || use.index() != call->num_ops() - 1)
+            return Role::None;
+        for (auto& b : builtins) {
+            if (callee->name() != b.name)
+                continue;
+            // OpenCL builtins take the dimension; the others only take the memory
+            if (call->num_args() == 3 && call->arg(1)->isa<PrimLit>() && is_type_i(call->arg(1)->type()))
+                return is_zero(call->arg(1)) ? b.role : Role::Uniform;
+            return call->num_args() == 2 ? b.role : Role::None;
+        }
+        return Role::None;
+    }
+
+    /// Is @p def the same for all threads of a one-dimensional launch?
+    bool is_uniform(const Def* def) {
+        if (!scope_->contains(def))
+            return !def->isa_continuation();
+        if (auto param = def->isa<Param>()) {
+            if (param->continuation() == kernel_)
+                return param->index() >= 2;
+            return role(param) == Role::Uniform;
+        }
+        if (!def->isa<PrimOp>() || def->isa<MemOp>() || def->isa<Slot>())
+            return false;
+        for (auto op : def->ops()) {
+            if (!is_uniform(op))
+                return false;
+        }
+        return true;
+    }
+
+    /// Does @p def differ in all threads of a one-dimensional launch? Overflows are ignored.
+    bool is_injective(const Def* def) {
+        if (!one_dimensional_)
+            return false;
+        if (auto cast = def->isa<Cast>())
+            return is_widening(cast) && is_injective(cast->from());
+        if (auto arithop = def->isa<ArithOp>()) {
+            auto lhs = arithop->lhs(), rhs = arithop->rhs();
+            switch (arithop->arithop_tag()) {
+                case ArithOp_add: {
+                    // the global thread index: block index times block size plus local thread index
+                    auto global = [&] (const Def* group_offset, const Def* local) {
+                        auto mul = group_offset->isa<ArithOp>();
+                        if (!mul || mul->arithop_tag() != ArithOp_mul || role(local) != Role::Local)
+                            return false;
+                        return (role(mul->lhs()) == Role::Group && role(mul->rhs()) == Role::LocalSize)
+                            || (role(mul->lhs()) == Role::LocalSize && role(mul->rhs()) == Role::Group);
+                    };
+                    return global(lhs, rhs) || global(rhs, lhs)
+                        || (is_injective(lhs) && is_uniform(rhs)) || (is_uniform(lhs) && is_injective(rhs));
+                }
+                case ArithOp_sub:
+                    return is_injective(lhs) && is_uniform(rhs);
+                case ArithOp_mul:
+                    return (is_injective(lhs) && rhs->isa<PrimLit>() && !is_zero(rhs))
+                        || (is_injective(rhs) && lhs->isa<PrimLit>() && !is_zero(lhs));
+                default:
+                    return false;
+            }
+        }
+        return role(def) == Role::Global;
+    }
+
+    /**
+     * Structural key of an index expression that only depends on launch arguments and thread/block ids.
+     * Thread/block ids are results of the pure @p builtins; other imported functions like @c clock or @c rand may
+     * return different values in both kernels. Returns an empty string for anything else.
+     */
+    std::string index_key(const Def* def) {
+        auto i = keys_.find(def);
+        if (i != keys_.end())
+            return i->second;
+
+        std::string key;
+        if (!scope_->contains(def)) {
+            if (!def->isa_continuation())
+                key = "def" + std::to_string(def->gid());
+        } else if (auto param = def->isa<Param>()) {
+            auto continuation = param->continuation();
+            if (continuation == kernel_) {
+                if (param->index() >= 2)
+                    key = "arg" + std::to_string(launch_->arg(LAUNCH_NUM_ARGS + param->index() - 2)->gid());
+            } else if (continuation->num_uses() == 1) {
+                if (role(param) != Role::None) {
+                    auto call = continuation->uses().begin()->def()->as_continuation();
+                    key = call->callee()->name().str();
+                    if (call->num_args() == 3)
+                        key += "(" + std::to_string(primlit_value<int64_t>(call->arg(1))) + ")";
+                    key += "." + std::to_string(param->index());
+                }
+            }
+        } else if (def->isa<PrimOp>() && !def->isa<MemOp>() && !def->isa<Slot>()) {
+            key = std::to_string(def->tag()) + ":" + std::to_string(def->type()->gid()) + "(";
+            for (auto op : def->ops()) {
+                auto op_key = index_key(op);
+                if (op_key.empty()) {
+                    key.clear();
+                    break;
+                }
+                key += op_key + ",";
+            }
+            if (!key.empty())
+                key += ")";
+        }
+        return keys_[def] = key;
+    }
+
+    World& world_;
+    bool one_dimensional_ = false;
+    const Scope* scope_ = nullptr;
+    Continuation* launch_ = nullptr;
+    Continuation* kernel_ = nullptr;
+    DefMap<std::string> keys_;
+};
+
+void fuse_kernels(World& world) {
+    FuseKernels(world).run();
+}
+
+}
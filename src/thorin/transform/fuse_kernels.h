@@ -0,0 +1,17 @@
+#ifndef THORIN_TRANSFORM_FUSE_KERNELS_H
+#define THORIN_TRANSFORM_FUSE_KERNELS_H
+
+namespace thorin {
+
+class World;
+
+/**
+ * Fuses back-to-back GPU kernel launches with the same device, grid and block configuration into a single kernel.
+ * Two launches are fused only if every buffer that is written by one kernel and accessed by the other one
+ * is accessed at the same index by both, and if buffers that may alias are not written.
+ */
+void fuse_kernels(World&);
+
+}
+
+#endif
@@ -1,10 +1,17 @@
+#include "thorin/analyses/alias.h"
 #include "thorin/analyses/scope.h"
 #include "thorin/analyses/schedule.h"
 #include "thorin/world.h"
+#include "thorin/util/persistent_map.h"
 
 namespace thorin {
 
 class ResolveLoads {
+    struct MemState {
+        PersistentMap<const Def*, const Def*> slots;  ///< Contents of safe slots and immutable globals.
+        PersistentMap<const Def*, const Def*> values; ///< Last value stored to or loaded from any other pointer.
+    };
+
 public:
     ResolveLoads(World& world)
         : world_(world)
@@ -19,56 +26,69 @@ public:
     }
 
     void resolve_loads(const Scope& scope) {
+        forwarded_.clear();
         for (auto node : scope.f_cfg().reverse_post_order()) {
             auto continuation = node->continuation();
             for (auto param : continuation->params()) {
-                if (param->type()->isa<MemType>()) {
-                    Def2Def mapping;
-                    resolve_loads(param, mapping);
-                }
+                // Memory parameters of blocks with a unique predecessor have already been visited through it
+                if (param->type()->isa<MemType>() && !forwarded_.contains(param))
+                    resolve_loads(scope, param);
             }
         }
     }
 
-    void resolve_loads(const Def* mem, Def2Def& mapping) {
+    void resolve_loads(const Scope& scope, const Def* param) {
         // Traverse the tree of memory objects and
         // incrementally build the contents of each
-        // safe slot/immutable global
-        while (mem) {
-            // This loop iterates through all uses, and processes them recursively.
-            // The last use is treated separately to be able to re-use the mapping.
-            auto uses = mem->copy_uses();
-            size_t i = 0, n = uses.size();
-            for (auto it = uses.begin(); i < n; ++i, ++it) {
-                if (i == n - 1) {
-                    mem = process_use(*it, mapping);
-                } else {
-                    Def2Def split_mapping = mapping;
-                    auto next_mem = process_use(*it, split_mapping);
-                    resolve_loads(next_mem, split_mapping);
-                }
+        // safe slot/immutable global along with the
+        // values known to be stored at other pointers.
+        // Each branch of the tree gets its own copy of
+        // the state, which is cheap since the maps are persistent.
+        std::vector<std::pair<const Def*, MemState>> stack;
+        stack.emplace_back(param, MemState());
+        while (!stack.empty()) {
+            auto mem   = stack.back().first;
+            auto state = std::move(stack.back().second);
+            stack.pop_back();
+
+            for (auto use : mem->copy_uses()) {
+                auto split_state = state;
+                if (auto next_mem = process_use(scope, use, split_state))
+                    stack.emplace_back(next_mem, std::move(split_state));
             }
-            if (n == 0)
-                break;
         }
     }
 
-    const Def* process_use(const Def* mem_use, Def2Def& mapping) {
+    const Def* process_use(const Scope& scope, Use use, MemState& state) {
+        auto mem_use = use.def();
         if (auto load = mem_use->isa<Load>()) {
             // Try to find the slot corresponding to this load
             auto slot = find_slot(load->ptr());
             if (slot) {
                 // If the slot has been found and is safe, try to find a value for it
-                auto slot_value = get_value(slot, mapping);
+                auto slot_value = get_value(slot, state.slots);
                 auto load_value = extract_from_slot(load->ptr(), slot_value, load->debug());
                 // If the loaded value is completely specified, replace the load
                 if (!contains_top(load_value)) {
                     todo_ = true;
                     load->replace(world_.tuple({ load->mem(), load_value }));
+                } else {
+                    // Otherwise, later loads of the same location can reuse this one
+                    state.slots.insert(slot, insert_to_slot(load->ptr(), slot_value, load->out_val(), load->debug()));
+                }
+            } else if (auto value = state.values.find(load->ptr())) {
+                // Forward the last value stored to or loaded from this pointer
+                if ((*value)->type() == load->out_val_type()) {
+                    todo_ = true;
+                    load->replace(world_.tuple({ load->mem(), *value }));
                 }
+            } else {
+                state.values.insert(load->ptr(), load->out_val());
             }
             return load->out_mem();
         } else if (auto store = mem_use->isa<Store>()) {
+            // Forget about everything the store may overwrite
+            invalidate(store->ptr(), state.values);
             // Try to find the slot corresponding to this store
             auto slot = find_slot(store->ptr());
             if (slot) {
@@ -76,10 +96,12 @@ public:
                     store->replace(store->mem());
                 } else {
                     // If the slot has been found and is safe, try to find a value for it
-                    auto slot_value = get_value(slot, mapping);
+                    auto slot_value = get_value(slot, state.slots);
                     auto stored_value = insert_to_slot(store->ptr(), slot_value, store->val(), store->debug());
-                    mapping[slot] = stored_value;
+                    state.slots.insert(slot, stored_value);
                 }
+            } else {
+                state.values.insert(store->ptr(), store->val());
             }
             return store->out_mem();
         } else if (auto enter = mem_use->isa<Enter>()) {
@@ -88,25 +110,56 @@ public:
             for (auto use : frame->uses()) {
                 // All the slots allocated at that point contain bottom
                 assert(use->isa<Slot>());
-                mapping[use.def()] = world_.bottom(use->type()->as<PtrType>()->pointee());
+                state.slots.insert(use.def(), world_.bottom(use->type()->as<PtrType>()->pointee()));
             }
             return enter->out_mem();
+        } else if (auto alloc = mem_use->isa<Alloc>()) {
+            // A fresh allocation cannot alias anything we know about
+            return alloc->out_mem();
+        } else if (auto assembly = mem_use->isa<Assembly>()) {
+            // Inline assembly may write to any pointer it gets hold of
+            state.values.clear();
+            return assembly->out_mem();
+        } else if (auto continuation = mem_use->isa_continuation()) {
+            // Continue into the callee if this jump is the only way to reach it
+            if (use.index() == 0)
+                return nullptr;
+            auto callee = continuation->callee()->isa_continuation();
+            if (callee && callee != scope.entry() && scope.contains(callee) && callee->num_uses() == 1) {
+                auto param = callee->param(use.index() - 1);
+                if (forwarded_.insert(param).second)
+                    return param;
+            }
+            return nullptr;
         } else {
             return nullptr;
         }
     }
 
-    const Def* get_value(const Def* alloc, Def2Def& mapping) {
-        auto it = mapping.find(alloc);
-        if (it != mapping.end())
-            return it->second;
+    void invalidate(const Def* ptr, PersistentMap<const Def*, const Def*>& values) {
+        std::vector<const Def*> clobbered;
+        values.for_each([&] (const Def* other, const Def*) {
+            if (alias_.alias(ptr, other) != AliasResult::NoAlias)
+                clobbered.push_back(other);
+        });
+        for (auto other : clobbered)
+            values.erase(other);
+    }
+
+    const Def* get_value(const Def* alloc, PersistentMap<const Def*, const Def*>& mapping) {
+        if (auto value = mapping.find(alloc))
+            return *value;
+        const Def* value = nullptr;
         if (auto global = alloc->isa<Global>()) {
             // Immutable globals will remain set to their initial value
             if (!global->is_mutable())
-                return mapping[alloc] = global->init();
+                value = global->init();
         }
         // Nothing is known about this allocation yet
-        return mapping[alloc] = world_.top(alloc->type()->as<PtrType>()->pointee(), alloc->debug());
+        if (!value)
+            value = world_.top(alloc->type()->as<PtrType>()->pointee(), alloc->debug());
+        mapping.insert(alloc, value);
+        return value;
     }
 
     const Def* extract_from_slot(const Def* ptr, const Def* slot_value, Debug dbg) {
@@ -142,21 +195,6 @@ public:
         return values[n];
     }
 
-    static bool is_safe_bitcast(const Bitcast* bitcast) {
-        // Support cast between pointers to definite and indefinite arrays
-        auto ptr_to   = bitcast->type()->isa<PtrType>();
-        auto ptr_from = bitcast->from()->type()->isa<PtrType>();
-        if (!ptr_to || !ptr_from)
-            return false;
-        auto array_to   = ptr_to->pointee()->isa<IndefiniteArrayType>();
-        auto array_from = ptr_from->pointee()->isa<DefiniteArrayType>();
-        if (!array_to || !array_from)
-            return false;
-        if (array_to->elem_type() != array_from->elem_type())
-            return false;
-        return true;
-    }
-
 #define CACHED(name, ...) \
 private: \
     DefMap<bool> name##_; \
@@ -263,6 +301,8 @@ public: \
 private:
     bool todo_;
     World& world_;
+    AliasAnalysis alias_;
+    DefSet forwarded_;
 };
 
 bool resolve_loads(World& world) {
@@ -1,5 +1,9 @@
+#include "thorin/primop.h"
 #include "thorin/transform/mangle.h"
 #include "thorin/world.h"
+#include "thorin/util/log.h"
+
+#include <cstdlib>
 
 namespace thorin {
 
@@ -97,6 +101,237 @@ static void rewrite_def(const Def* def, Type2Type& types, Rewriter& rewriter) {
     }
 }
 
+/// A flow graph whose tasks and edges are all created on a straight-line path that ends in its only execution.
+struct StaticGraph {
+    std::vector<Continuation*> calls;     ///< Calls to the graph runtime, in program order.
+    std::vector<const Def*> tasks;        ///< Task ids as returned by @c anydsl_create_task.
+    std::vector<const Def*> closures;     ///< Closure of each task.
+    std::vector<std::pair<size_t, size_t>> edges;
+    Continuation* execute = nullptr;
+    size_t entry = 0;
+};
+
+static Continuation* callee_named(Continuation* cont, const char* name) {
+    auto callee = cont->callee()->isa_continuation();
+    return callee && callee->is_imported() && callee->name() == name ? callee : nullptr;
+}
+
+static Continuation* return_cont(Continuation* call, size_t num_args) {
+    if (call->num_args() != num_args)
+        return nullptr;
+    auto ret = call->args().back()->isa_continuation();
+    return ret && ret->num_uses() == 1 ? ret : nullptr;
+}
+
+static bool find_static_graph(Continuation* create_graph, StaticGraph& graph) {
+    auto ret = return_cont(create_graph, 2);
+    if (!ret || ret->num_params() != 2)
+        return false;
+    auto graph_id = ret->param(1);
+    graph.calls.push_back(create_graph);
+
+    auto task_index = [&] (const Def* def) {
+        auto i = std::find(graph.tasks.begin(), graph.tasks.end(), def);
+        return i == graph.tasks.end() ? size_t(-1) : size_t(i - graph.tasks.begin());
+    };
+
+    // follow the chain of calls until the graph is executed
+    auto cur = ret;
+    while (!graph.execute) {
+        if (cur->empty())
+            return false;
+        if (callee_named(cur, "anydsl_create_task")) {
+            auto next = return_cont(cur, 4);
+            if (!next || next->num_params() != 2 || cur->arg(1) != graph_id)
+                return false;
+            graph.tasks.push_back(next->param(1));
+            graph.closures.push_back(cur->arg(2));
+        } else if (callee_named(cur, "anydsl_create_edge")) {
+            auto from = task_index(cur->arg(1)), to = task_index(cur->arg(2));
+            if (!return_cont(cur, 4) || from == size_t(-1) || to == size_t(-1))
+                return false;
+            graph.edges.emplace_back(from, to);
+        } else if (callee_named(cur, "anydsl_execute_graph")) {
+            graph.entry = task_index(cur->arg(2));
+            if (cur->num_args() != 4 || cur->arg(1) != graph_id || graph.entry == size_t(-1))
+                return false;
+            graph.execute = cur;
+            break;
+        } else {
+            // plain jumps to a block without other predecessors keep the path straight
+            auto callee = cur->callee()->isa_continuation();
+            if (!callee || callee->empty() || callee->is_intrinsic() || callee->num_uses() != 1 || cur->num_args() != 0)
+                return false;
+            cur = callee;
+            continue;
+        }
+        graph.calls.push_back(cur);
+        cur = cur->args().back()->as_continuation();
+    }
+
+    // the graph and its tasks must not be used anywhere else
+    if (graph_id->num_uses() != graph.tasks.size() + 1)
+        return false;
+    std::vector<size_t> num_task_uses(graph.tasks.size(), 0);
+    for (auto edge : graph.edges) {
+        num_task_uses[edge.first]++;
+        num_task_uses[edge.second]++;
+    }
+    num_task_uses[graph.entry]++;
+    for (size_t i = 0, e = graph.tasks.size(); i != e; ++i) {
+        if (graph.tasks[i]->num_uses() != num_task_uses[i])
+            return false;
+    }
+    return true;
+}
+
+static Continuation* execute_task_table(World& world, const Type* closure_type) {
+    for (auto cont : world.continuations()) {
+        if (cont->is_imported() && cont->name() == "anydsl_execute_task_table")
+            return cont;
+    }
+    auto i32_ptr = world.ptr_type(world.indefinite_array_type(world.type_qs32()));
+    auto fn_type = world.fn_type({
+        world.mem_type(), world.type_qs32(), i32_ptr, i32_ptr,
+        world.ptr_type(world.indefinite_array_type(closure_type)),
+        world.fn_type({ world.mem_type() })
+    });
+    return world.continuation(fn_type, Continuation::Attributes(Visibility::Imported), Debug("anydsl_execute_task_table"));
+}
+
+static const Def* index_table(World& world, const std::vector<size_t>& offsets) {
+    Array<const Def*> elems(offsets.size());
+    for (size_t i = 0, e = offsets.size(); i != e; ++i)
+        elems[i] = world.literal_qs32(offsets[i], {});
+    auto table = world.global(world.definite_array(world.type_qs32(), elems), false);
+    return world.bitcast(world.ptr_type(world.indefinite_array_type(world.type_qs32())), table);
+}
+
+/**
+ * Replaces the construction and execution of a @p StaticGraph with a single call to @c anydsl_execute_task_table.
+ * Tasks that are only reachable through one another are fused into sequential groups,
+ * and groups are sorted by their topological level so that all groups of a level can run in parallel.
+ */
+static bool lower_static_graph(World& world, StaticGraph& graph) {
+    auto num_tasks = graph.tasks.size();
+    std::vector<std::vector<size_t>> succs(num_tasks), preds(num_tasks);
+    for (auto edge : graph.edges) {
+        succs[edge.first].push_back(edge.second);
+        preds[edge.second].push_back(edge.first);
+    }
+
+    // only tasks reachable from the entry run; they must not wait for any other task
+    std::vector<bool> reachable(num_tasks, false);
+    std::vector<size_t> stack(1, graph.entry);
+    reachable[graph.entry] = true;
+    while (!stack.empty()) {
+        auto task = stack.back();
+        stack.pop_back();
+        for (auto succ : succs[task]) {
+            if (!reachable[succ]) {
+                reachable[succ] = true;
+                stack.push_back(succ);
+            }
+        }
+    }
+    if (!preds[graph.entry].empty())
+        return false;
+    for (size_t i = 0; i != num_tasks; ++i) {
+        for (auto pred : preds[i]) {
+            if (reachable[i] && !reachable[pred])
+                return false;
+        }
+    }
+
+    // fuse chains of tasks with a single successor/predecessor and compute the level of each chain
+    auto fused = [&] (size_t task) { return preds[task].size() == 1 && succs[preds[task].front()].size() == 1; };
+    std::vector<size_t> group(num_tasks, size_t(-1)), levels;
+    std::vector<std::vector<size_t>> groups;
+    std::vector<size_t> num_preds(num_tasks);
+    std::vector<size_t> ready(1, graph.entry);
+    for (size_t i = 0; i != num_tasks; ++i)
+        num_preds[i] = preds[i].size();
+    while (!ready.empty()) {
+        auto task = ready.back();
+        ready.pop_back();
+        size_t level = 0;
+        for (auto pred : preds[task])
+            level = std::max(level, levels[group[pred]] + 1);
+        groups.emplace_back();
+        levels.push_back(level);
+        while (true) {
+            group[task] = groups.size() - 1;
+            groups.back().push_back(task);
+            if (succs[task].size() != 1 || !fused(succs[task].front()))
+                break;
+            task = succs[task].front();
+        }
+        for (auto succ : succs[task]) {
+            if (--num_preds[succ] == 0)
+                ready.push_back(succ);
+        }
+    }
+    if (groups.empty())
+        return false;
+
+    std::vector<size_t> order(groups.size());
+    for (size_t i = 0, e = order.size(); i != e; ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&] (size_t a, size_t b) { return levels[a] < levels[b]; });
+
+    std::vector<size_t> level_offsets, group_offsets;
+    std::vector<const Def*> closures;
+    for (auto i : order) {
+        if (level_offsets.size() <= levels[i])
+            level_offsets.push_back(group_offsets.size());
+        group_offsets.push_back(closures.size());
+        for (auto task : groups[i])
+            closures.push_back(graph.closures[task]);
+    }
+    auto num_levels = level_offsets.size();
+    level_offsets.push_back(group_offsets.size());
+    group_offsets.push_back(closures.size());
+
+    DLOG("lowering static flow graph with {} tasks in {} groups and {} levels", closures.size(), groups.size(), num_levels);
+
+    // the creation calls now simply continue with the task ids
+    for (auto call : graph.calls) {
+        auto ret = call->args().back()->as_continuation();
+        if (ret->num_params() == 2)
+            call->jump(ret, { call->arg(0), world.literal_qs32(0, {}) }, call->jump_debug());
+        else
+            call->jump(ret, { call->arg(0) }, call->jump_debug());
+    }
+
+    auto call = graph.execute;
+    auto closure_type = closures.front()->type();
+    auto execute = execute_task_table(world, closure_type);
+    auto enter = world.enter(call->arg(0));
+    auto mem = world.extract(enter, 0_u32);
+    auto slot = world.slot(world.definite_array_type(closure_type, closures.size()), world.extract(enter, 1_u32));
+    mem = world.store(mem, slot, world.definite_array(closure_type, closures));
+    auto tasks = world.bitcast(world.ptr_type(world.indefinite_array_type(closure_type)), slot);
+    call->jump(execute, {
+        mem,
+        world.literal_qs32(num_levels, {}),
+        index_table(world, level_offsets),
+        index_table(world, group_offsets),
+        tasks,
+        call->args().back()
+    }, call->jump_debug());
+    return true;
+}
+
+static void lower_static_graphs(World& world) {
+    for (auto cont : world.copy_continuations()) {
+        if (cont->empty() || !callee_named(cont, "anydsl_create_graph"))
+            continue;
+        StaticGraph graph;
+        if (find_static_graph(cont, graph) && !lower_static_graph(world, graph))
+            VLOG("cannot lower flow graph created in {} statically", cont);
+    }
+}
+
 void rewrite_flow_graphs(World& world) {
     Rewriter rewriter;
     std::vector<std::pair<Continuation*, Continuation*>> transformed;
@@ -148,6 +383,11 @@ void rewrite_flow_graphs(World& world) {
     }
 
     world.cleanup();
+    // opt-in until the runtime provides anydsl_execute_task_table
+    if (std::getenv("ANYDSL_STATIC_FLOW_GRAPHS")) {
+        lower_static_graphs(world);
+        world.cleanup();
+    }
 }
 
 }
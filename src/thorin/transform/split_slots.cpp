@@ -14,23 +14,75 @@ struct IndexHash {
     static u32 sentinel() { return 0xFFFFFFFF; }
 };
 
+/// Arrays with at most this many elements are split even if they are accessed with dynamic indices.
+static const u64 max_dynamic_dim = 16;
+
+static size_t num_elems(const Type* type) {
+    if (auto array_type = type->isa<DefiniteArrayType>())
+        return array_type->dim();
+    return type->num_ops();
+}
+
+static const Type* elem_type(const Type* type, size_t i) {
+    if (auto array_type = type->isa<DefiniteArrayType>())
+        return array_type->elem_type();
+    return type->op(i);
+}
+
+/// Lowers an access through a dynamic index into a chain of accesses to all element slots that are combined with selects.
+template<class F>
+static void split_dynamic(const LEA* lea, size_t dim, F elem_slot) {
+    auto& world = lea->world();
+    auto index = lea->index();
+    auto tag = index->type()->as<PrimType>()->primtype_tag();
+    auto is_index = [&] (size_t i, Debug dbg) {
+        return world.cmp_eq(index, world.literal(tag, Box(u64(i)), dbg), dbg);
+    };
+
+    for (auto use : lea->copy_uses()) {
+        if (auto store = use->isa<Store>()) {
+            auto in_mem = store->mem();
+            for (size_t i = 0; i != dim; ++i) {
+                auto tuple = world.load(in_mem, elem_slot(i), store->debug());
+                auto old = world.extract(tuple, 1_u32, store->debug());
+                in_mem = world.extract(tuple, 0_u32, store->debug());
+                auto val = world.select(is_index(i, store->debug()), store->val(), old, store->debug());
+                in_mem = world.store(in_mem, elem_slot(i), val, store->debug());
+            }
+            store->replace(in_mem);
+        } else if (auto load = use->isa<Load>()) {
+            auto in_mem = load->mem();
+            const Def* val = nullptr;
+            for (size_t i = 0; i != dim; ++i) {
+                auto tuple = world.load(in_mem, elem_slot(i), load->debug());
+                auto elem = world.extract(tuple, 1_u32, load->debug());
+                in_mem = world.extract(tuple, 0_u32, load->debug());
+                val = val ? world.select(is_index(i, load->debug()), elem, val, load->debug()) : elem;
+            }
+            load->replace(world.tuple({ in_mem, val }, load->debug()));
+        }
+    }
+}
+
 static void split(const Slot* slot) {
-    auto array_type = slot->alloced_type()->as<DefiniteArrayType>();
-    auto dim = array_type->dim();
-    auto elem_type = array_type->elem_type();
+    auto type = slot->alloced_type();
+    auto dim = num_elems(type);
 
     HashMap<u32, const Def*, IndexHash> new_slots;
     auto& world = slot->world();
 
     auto elem_slot = [&] (u32 index) {
         if (!new_slots.contains(index))
-            new_slots[index] = world.slot(elem_type, slot->frame(), slot->debug());
+            new_slots[index] = world.slot(elem_type(type, index), slot->frame(), slot->debug());
         return new_slots[index];
     };
 
     for (auto use : slot->copy_uses()) {
         if (auto lea = use->isa<LEA>()) {
-            lea->replace(elem_slot(lea->index()->as<PrimLit>()->value().get_u32()));
+            if (lea->index()->isa<PrimLit>())
+                lea->replace(elem_slot(primlit_value<u32>(lea->index())));
+            else
+                split_dynamic(lea, dim, elem_slot);
         } else if (auto store = use->isa<Store>()) {
             auto in_mem = store->op(0);
             for (size_t i = 0, e = dim; i != e; ++i) {
@@ -40,28 +92,56 @@ static void split(const Slot* slot) {
             store->replace(in_mem);
         } else if (auto load = use->isa<Load>()) {
             auto in_mem = load->op(0);
-            auto array = world.bottom(array_type, load->debug());
+            auto agg = world.bottom(type, load->debug());
             for (size_t i = 0, e = dim; i != e; ++i) {
                 auto tuple = world.load(in_mem, elem_slot(i), load->debug());
                 auto elem = world.extract(tuple, 1_u32, load->debug());
                 in_mem = world.extract(tuple, 0_u32, load->debug());
-                array = world.insert(array, i, elem, load->debug());
+                agg = world.insert(agg, i, elem, load->debug());
             }
-            load->replace(world.tuple({ in_mem, array }, load->debug()));
+            load->replace(world.tuple({ in_mem, agg }, load->debug()));
         }
     }
 }
 
+static bool can_split_dynamic(const LEA* lea) {
+    // small arrays of scalars only, so that each access turns into a few selects
+    auto array_type = lea->ptr_pointee()->isa<DefiniteArrayType>();
+    if (!array_type || array_type->dim() > max_dynamic_dim)
+        return false;
+    if (!array_type->elem_type()->isa<PrimType>() && !array_type->elem_type()->isa<PtrType>())
+        return false;
+    auto index_type = lea->index()->type()->isa<PrimType>();
+    if (!index_type || index_type->length() != 1)
+        return false;
+
+    for (auto use : lea->uses()) {
+        if (use->isa<Store>()) {
+            if (use.index() != 1)
+                return false;
+        } else if (!use->isa<Load>()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 static bool can_split(const Slot* slot) {
-    if (!slot->alloced_type()->isa<DefiniteArrayType>())
+    auto type = slot->alloced_type();
+    if (!type->isa<DefiniteArrayType>() && !type->isa<TupleType>() && !type->isa<StructType>())
         return false;
 
-    // only accept LEAs with constant indices and loads and stores
+    // only accept LEAs with constant or bounded dynamic indices and loads and stores
     for (auto use : slot->uses()) {
         if (auto lea = use->isa<LEA>()) {
-            if (!is_const(lea->index()))
+            if (!lea->index()->isa<PrimLit>() && !can_split_dynamic(lea))
+                return false;
+        } else if (use->isa<Store>()) {
+            // the address of the slot must not be stored
+            if (use.index() != 1)
                 return false;
-        } else if (!use->isa<Store>() && !use->isa<Load>()) {
+        } else if (!use->isa<Load>()) {
             return false;
         }
     }
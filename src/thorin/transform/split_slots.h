@@ -6,7 +6,10 @@ namespace thorin {
 class World;
 
 /**
- * Tries to split @p Slot%s that are accessed through constant @p LEA%s.
+ * Scalar replacement of aggregates: splits @p Slot%s of array, tuple and struct type into one @p Slot per element.
+ * Elements have to be accessed through constant @p LEA%s, except for small arrays of scalars,
+ * where dynamic indices are lowered to selects over all elements.
+ * Nested aggregates are split iteratively.
  */
 void split_slots(World&);
 
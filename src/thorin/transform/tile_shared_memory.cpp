@@ -0,0 +1,404 @@
+#include "thorin/primop.h"
+#include "thorin/world.h"
+#include "thorin/analyses/cfg.h"
+#include "thorin/analyses/domtree.h"
+#include "thorin/analyses/schedule.h"
+#include "thorin/analyses/scope.h"
+#include "thorin/transform/tile_shared_memory.h"
+#include "thorin/util/log.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace thorin {
+
+struct Builtins {
+    const char* thread_id;
+    const char* barrier;
+    bool fence;             ///< Does the barrier take CLK_LOCAL_MEM_FENCE as argument?
+};
+
+static const Builtins builtins[] = {
+    { "threadIdx_x",                   "__syncthreads",      false },
+    { "llvm.nvvm.read.ptx.sreg.tid.x", "llvm.nvvm.barrier0", false },
+    { "get_local_id",                  "barrier",            true  },
+};
+
+/// Functions that return the same value for all threads of a block.
+static const char* uniform_builtins[] = {
+    "blockIdx_x", "blockIdx_y", "blockIdx_z",
+    "blockDim_x", "blockDim_y", "blockDim_z",
+    "gridDim_x",  "gridDim_y",  "gridDim_z",
+    "llvm.nvvm.read.ptx.sreg.ctaid.x",  "llvm.nvvm.read.ptx.sreg.ctaid.y",  "llvm.nvvm.read.ptx.sreg.ctaid.z",
+    "llvm.nvvm.read.ptx.sreg.ntid.x",   "llvm.nvvm.read.ptx.sreg.ntid.y",   "llvm.nvvm.read.ptx.sreg.ntid.z",
+    "llvm.nvvm.read.ptx.sreg.nctaid.x", "llvm.nvvm.read.ptx.sreg.nctaid.y", "llvm.nvvm.read.ptx.sreg.nctaid.z",
+    "get_group_id", "get_local_size", "get_num_groups",
+};
+
+static const int max_halo = 32;
+
+class TileSharedMemory {
+    struct Tile {
+        const Param* buffer;
+        const Def* base;                                    ///< Common part of the indices of all loads.
+        std::vector<std::pair<const Load*, int64_t>> loads; ///< Loads with their offset from @p base.
+        int64_t left, right;                                ///< Halo sizes.
+    };
+
+public:
+    TileSharedMemory(World& world, Cont2Config& kernel_config)
+        : world_(world)
+        , kernel_config_(kernel_config)
+    {}
+
+    void run() {
+        bool todo = false;
+        for (auto continuation : world_.exported_continuations()) {
+            auto config = kernel_config_.find(continuation);
+            if (!continuation->empty() && config != kernel_config_.end())
+                todo |= tile(continuation, config->second->as<GPUKernelConfig>()->block_size());
+        }
+        if (!todo)
+            return;
+
+        // the cleanup rebuilds the kernels: recover their configurations by name
+        std::vector<std::pair<std::string, std::unique_ptr<KernelConfig>>> configs;
+        for (auto continuation : world_.exported_continuations()) {
+            auto config = kernel_config_.find(continuation);
+            if (config != kernel_config_.end()) {
+                configs.emplace_back(continuation->name().str(), std::move(config->second));
+                kernel_config_.erase(config);
+            }
+        }
+        world_.cleanup();
+        for (auto continuation : world_.exported_continuations()) {
+            for (auto& p : configs) {
+                if (p.second && p.first == continuation->name().str())
+                    kernel_config_.emplace(continuation, std::move(p.second));
+            }
+        }
+    }
+
+private:
+    bool tile(Continuation* kernel, std::tuple<int, int, int> block) {
+        block_size_ = std::get<0>(block);
+        if (block_size_ <= 0 || std::get<1>(block) != 1 || std::get<2>(block) != 1)
+            return false;
+
+        // the barrier has to be reached by all threads: stage the tiles at the end of the straight-line prefix of the kernel
+        prefix_.clear();
+        auto last = kernel;
+        while (true) {
+            prefix_.insert(last);
+            auto callee = last->callee()->isa_continuation();
+            if (!callee || !callee->is_imported() || last->num_args() == 0)
+                break;
+            auto ret = last->args().back()->isa_continuation();
+            if (!ret || ret->empty() || ret->num_uses() != 1 || prefix_.contains(ret) || !ret->mem_param())
+                break;
+            last = ret;
+        }
+        if (last == kernel || !last->mem_param())
+            return false;
+
+        // the tiles are loaded without bounds checks: only stage buffers that every thread loads anyway after the prefix
+        unconditional_.clear();
+        {
+            Scope scope(kernel);
+            auto& post_domtree = scope.b_cfg().domtree();
+            auto m = post_domtree.cfg()[last];
+            for (auto& block : Schedule(scope, Schedule::Late)) {
+                auto n = post_domtree.cfg()[block.continuation()];
+                if (!m || !n || !post_domtree.dominates(n, m))
+                    continue;
+                for (auto primop : block) {
+                    if (primop->isa<Load>())
+                        unconditional_.insert(primop);
+                }
+            }
+        }
+
+        kernel_ = kernel;
+        builtins_ = nullptr;
+        thread_id_ = nullptr;
+        std::vector<Tile> tiles;
+        for (auto param : kernel->params()) {
+            Tile tile;
+            if (param->index() >= 2 && analyze(param, last->mem_param(), tile))
+                tiles.push_back(std::move(tile));
+        }
+        if (tiles.empty())
+            return false;
+
+        // stage the tiles in a new continuation in front of the last one of the prefix, which continues after the barrier
+        auto pred = last->uses().begin()->def()->as_continuation();
+        Array<const Def*> pred_args(pred->args());
+        last_ = last;
+        staged_ = world_.continuation(last->type(), last->debug());
+        pred_args.back() = staged_;
+        pred->jump(pred->callee(), pred_args, pred->jump_debug());
+
+        auto cur = staged_;
+        const Def* mem = staged_->mem_param();
+        for (auto& tile : tiles) {
+            DLOG("staging {} of kernel {} in shared memory with halo ({}, {})", tile.buffer, kernel, tile.left, tile.right);
+            auto ptr = stage(cur, mem, tile);
+            for (auto& p : tile.loads) {
+                auto load = p.first;
+                auto index = offset(thread_id_, tile.left + p.second);
+                load->replace(world_.load(load->mem(), world_.lea(ptr, index, load->debug()), load->debug()));
+            }
+        }
+
+        auto body = world_.continuation(world_.fn_type({ world_.mem_type() }), last->debug());
+        auto barrier = find_barrier();
+        if (builtins_->fence)
+            cur->jump(barrier, { mem, world_.literal_qu32(1, {}), body });
+        else
+            cur->jump(barrier, { mem, body });
+        Array<const Def*> args(staged_->params().size(), [&] (size_t i) { return is_mem(staged_->param(i)) ? body->param(0) : staged_->param(i); });
+        body->jump(last, args);
+        return true;
+    }
+
+    /**
+     * Can @p param be staged? All its loads must use the thread index plus a constant and read @p mem, before any store.
+     * Moreover, each thread must execute them: the tile would read out of bounds where the kernel guards its loads.
+     */
+    bool analyze(const Param* param, const Def* mem, Tile& tile) {
+        auto ptr_type = param->type()->isa<PtrType>();
+        if (!ptr_type || (ptr_type->addr_space() != AddrSpace::Generic && ptr_type->addr_space() != AddrSpace::Global))
+            return false;
+        auto array_type = ptr_type->pointee()->isa<IndefiniteArrayType>();
+        if (!array_type || !array_type->elem_type()->isa<PrimType>())
+            return false;
+
+        tile.buffer = param;
+        tile.base = nullptr;
+        for (auto use : param->uses()) {
+            auto lea = use->isa<LEA>();
+            if (!lea || use.index() != 0)
+                return false;
+            auto p = split_offset(lea->index());
+            if ((tile.base && tile.base != p.first) || std::abs(p.second) > max_halo)
+                return false;
+            tile.base = p.first;
+            for (auto lea_use : lea->uses()) {
+                auto load = lea_use->isa<Load>();
+                if (!load || mem_root(load->mem()) != mem || !unconditional_.contains(load))
+                    return false;
+                tile.loads.emplace_back(load, p.second);
+            }
+        }
+        if (!tile.base || !is_thread_linear(tile.base))
+            return false;
+
+        // only stage elements that are loaded anyway: the halos must match the smallest and largest offset
+        std::vector<int64_t> offsets;
+        for (auto& p : tile.loads)
+            offsets.push_back(p.second);
+        std::sort(offsets.begin(), offsets.end());
+        offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+        tile.left  = -offsets.front();
+        tile.right =  offsets.back();
+        return offsets.size() >= 2 && tile.left >= 0 && tile.right >= 0 && tile.left + tile.right < block_size_;
+    }
+
+    /**
+     * Emits the reserve of the tile and the cooperative loads into it from @p cur on, where @p mem is the current memory.
+     * Afterwards, @p cur and @p mem are the continuation and memory at the end of the emitted code.
+     */
+    const Def* stage(Continuation*& cur, const Def*& mem, const Tile& tile) {
+        auto elem_type = tile.buffer->type()->as<PtrType>()->pointee()->as<IndefiniteArrayType>()->elem_type();
+        auto ptr_type = world_.ptr_type(world_.indefinite_array_type(elem_type), 1, -1, AddrSpace::Shared);
+        auto reserve = world_.continuation(world_.fn_type({ world_.mem_type(), world_.type_qs32(), world_.fn_type({ world_.mem_type(), ptr_type }) }),
+                                           Intrinsic::Reserve, Debug("reserve_shared"));
+        auto reserved = world_.continuation(world_.fn_type({ world_.mem_type(), ptr_type }), Debug("tile"));
+        cur->jump(reserve, { mem, world_.literal_qs32(block_size_ + tile.left + tile.right, {}), reserved });
+        auto ptr = reserved->param(1);
+
+        auto base = staged(tile.base);
+        auto thread_id = staged(thread_id_);
+        auto copy = [&] (const Def* mem, int64_t src, int64_t dst) {
+            auto load = world_.load(mem, world_.lea(tile.buffer, offset(base, src), {}));
+            return world_.store(world_.extract(load, 0_u32), world_.lea(ptr, offset(thread_id, dst), {}), world_.extract(load, 1_u32));
+        };
+
+        cur = reserved;
+        mem = copy(reserved->param(0), 0, tile.left);
+        auto halo = [&] (const Def* cond, int64_t src, int64_t dst) {
+            auto load = world_.continuation(Debug("tile_halo"));
+            auto skip = world_.continuation(Debug("tile_skip"));
+            auto join = world_.continuation(world_.fn_type({ world_.mem_type() }), Debug("tile_join"));
+            cur->branch(cond, load, skip);
+            load->jump(join, { copy(mem, src, dst) });
+            skip->jump(join, { mem });
+            cur = join;
+            mem = join->param(0);
+        };
+        // threads at the borders of the block also load the halo
+        if (tile.left > 0)
+            halo(world_.cmp_lt(thread_id, constant(thread_id->type(), tile.left)), -tile.left, 0);
+        if (tile.right > 0)
+            halo(world_.cmp_ge(thread_id, constant(thread_id->type(), block_size_ - tile.right)), tile.right, tile.left + tile.right);
+        return ptr;
+    }
+
+    /// Rebuilds @p def in the staging code, where the params of the last continuation of the prefix are not available yet.
+    const Def* staged(const Def* def) {
+        if (auto param = def->isa<Param>())
+            return param->continuation() == last_ ? staged_->param(param->index()) : def;
+        auto primop = def->isa<PrimOp>();
+        if (!primop)
+            return def;
+        Array<const Def*> ops(primop->num_ops(), [&] (size_t i) { return staged(primop->op(i)); });
+        return primop->rebuild(ops);
+    }
+
+    Continuation* find_barrier() {
+        auto type = builtins_->fence
+            ? world_.fn_type({ world_.mem_type(), world_.type_qu32(), world_.fn_type({ world_.mem_type() }) })
+            : world_.fn_type({ world_.mem_type(), world_.fn_type({ world_.mem_type() }) });
+        for (auto continuation : world_.continuations()) {
+            if (continuation->is_imported() && continuation->name() == builtins_->barrier && continuation->type() == type)
+                return continuation;
+        }
+        auto callee = builtin_call(thread_id_leaf())->callee()->as_continuation();
+        return world_.continuation(type, { Visibility::Imported, callee->cc() }, Debug(builtins_->barrier));
+    }
+
+    const Def* constant(const Type* type, int64_t value) {
+        return world_.cast(type, world_.literal_qs64(value, {}));
+    }
+
+    /// @p def plus the constant @p offset.
+    const Def* offset(const Def* def, int64_t offset) {
+        return world_.arithop_add(def, constant(def->type(), offset));
+    }
+
+    static int64_t value(const Def* def) {
+        return def->world().cast(def->world().type_qs64(), def)->as<PrimLit>()->qs64_value();
+    }
+
+    static std::pair<const Def*, int64_t> split_offset(const Def* def) {
+        if (auto arithop = def->isa<ArithOp>()) {
+            if (arithop->arithop_tag() == ArithOp_add) {
+                if (arithop->rhs()->isa<PrimLit>()) return { arithop->lhs(),  value(arithop->rhs()) };
+                if (arithop->lhs()->isa<PrimLit>()) return { arithop->rhs(),  value(arithop->lhs()) };
+            } else if (arithop->arithop_tag() == ArithOp_sub && arithop->rhs()->isa<PrimLit>()) {
+                return { arithop->lhs(), -value(arithop->rhs()) };
+            }
+        }
+        return { def, 0 };
+    }
+
+    /**
+     * Follows @p mem up over loads and enters.
+     * A store stops the walk: the buffer to stage may alias the stored one, and the tile would miss the stored value.
+     */
+    static const Def* mem_root(const Def* mem) {
+        while (auto extract = mem->isa<Extract>()) {
+            if (!extract->agg()->isa<Load>() && !extract->agg()->isa<Enter>())
+                break;
+            mem = extract->agg()->as<MemOp>()->mem();
+        }
+        return mem;
+    }
+
+    /// Returns the call to an imported function in the prefix whose result is @p def.
+    const Continuation* builtin_call(const Def* def) {
+        auto param = def->isa<Param>();
+        if (!param || is_mem(param) || !prefix_.contains(param->continuation()) || param->continuation() == kernel_)
+            return nullptr;
+        auto use = *param->continuation()->uses().begin();
+        auto call = use->isa_continuation();
+        if (!call || use.index() != call->num_ops() - 1 || !call->callee()->as_continuation()->is_imported())
+            return nullptr;
+        // the dimension must be known
+        for (size_t i = 1, e = call->num_args() - 1; i != e; ++i) {
+            if (!call->arg(i)->isa<PrimLit>())
+                return nullptr;
+        }
+        return call;
+    }
+
+    const Def* thread_id_leaf() {
+        auto def = thread_id_;
+        while (auto cast = def->isa<Cast>())
+            def = cast->from();
+        return def;
+    }
+
+    /// Is @p def the thread index within the block?
+    bool is_thread_id(const Def* def) {
+        auto leaf = def;
+        while (auto cast = leaf->isa<Cast>())
+            leaf = cast->from();
+        auto call = builtin_call(leaf);
+        if (!call)
+            return false;
+        auto name = call->callee()->name().str();
+        for (auto& b : builtins) {
+            if (name != b.thread_id)
+                continue;
+            if (call->num_args() > 2 && value(call->arg(1)) != 0)
+                return false;
+            if ((builtins_ && builtins_ != &b) || (thread_id_ && thread_id_ != def))
+                return false;
+            builtins_ = &b;
+            thread_id_ = def;
+            return true;
+        }
+        return false;
+    }
+
+    /// Is @p def the same for all threads of a block?
+    bool is_uniform(const Def* def) {
+        if (def->isa<PrimLit>())
+            return true;
+        if (auto param = def->isa<Param>()) {
+            if (param->continuation() == kernel_)
+                return param->index() >= 2;
+            auto call = builtin_call(param);
+            if (!call)
+                return false;
+            auto name = call->callee()->name().str();
+            return std::any_of(std::begin(uniform_builtins), std::end(uniform_builtins), [&] (const char* n) { return name == n; });
+        }
+        if (!def->isa<PrimOp>() || def->isa<MemOp>() || def->isa<Slot>() || def->isa<Global>())
+            return false;
+        for (auto op : def->ops()) {
+            if (!is_uniform(op))
+                return false;
+        }
+        return true;
+    }
+
+    /// Is @p def a block-uniform value plus the thread index?
+    bool is_thread_linear(const Def* def) {
+        if (is_thread_id(def))
+            return true;
+        auto arithop = def->isa<ArithOp>();
+        if (!arithop || arithop->arithop_tag() != ArithOp_add)
+            return false;
+        return (is_thread_id(arithop->lhs()) && is_uniform(arithop->rhs())) ||
+               (is_thread_id(arithop->rhs()) && is_uniform(arithop->lhs()));
+    }
+
+    World& world_;
+    Cont2Config& kernel_config_;
+    ContinuationSet prefix_;
+    DefSet unconditional_;  ///< Loads that post-dominate the last continuation of the prefix.
+    Continuation* kernel_ = nullptr;
+    Continuation* last_ = nullptr;
+    Continuation* staged_ = nullptr;
+    const Builtins* builtins_ = nullptr;
+    const Def* thread_id_ = nullptr;
+    int block_size_ = 0;
+};
+
+void tile_shared_memory(World& world, Cont2Config& kernel_config) {
+    TileSharedMemory(world, kernel_config).run();
+}
+
+}
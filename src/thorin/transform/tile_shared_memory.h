@@ -0,0 +1,21 @@
+#ifndef THORIN_TRANSFORM_TILE_SHARED_MEMORY_H
+#define THORIN_TRANSFORM_TILE_SHARED_MEMORY_H
+
+#include "thorin/be/kernel_config.h"
+
+namespace thorin {
+
+class World;
+
+/**
+ * Stages read-only kernel buffers that are loaded at neighbouring indices of the thread index into shared memory.
+ * Each block cooperatively loads the elements it needs into a tile reserved with @c reserve_shared
+ * and waits at a barrier before the loads are redirected to the tile.
+ * Only applies to kernels with a known, one-dimensional block size in @p kernel_config,
+ * whose entries are moved to the rebuilt kernels.
+ */
+void tile_shared_memory(World&, Cont2Config& kernel_config);
+
+}
+
+#endif
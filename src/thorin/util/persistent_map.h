@@ -0,0 +1,206 @@
+#ifndef THORIN_UTIL_PERSISTENT_MAP_H
+#define THORIN_UTIL_PERSISTENT_MAP_H
+
+#include <memory>
+#include <vector>
+
+#include "thorin/util/hash.h"
+#include "thorin/util/utility.h"
+
+namespace thorin {
+
+/**
+ * Hash array mapped trie with value semantics.
+ * Copying a @p PersistentMap is O(1) and both copies share their structure;
+ * @p insert and @p erase only copy the path from the root to the modified leaf.
+ * This makes it cheap to fork a map at every branch of a traversal.
+ * @p H has to provide the same interface as the hash functions used for @p HashMap.
+ */
+template<class Key, class Value, class H = GIDHash<Key>>
+class PersistentMap {
+private:
+    struct Node;
+    typedef std::shared_ptr<const Node> NodePtr;
+
+    struct Entry {
+        Entry(Key key, Value value)
+            : key(key)
+            , value(value)
+        {}
+        Entry(NodePtr node)
+            : node(node)
+            , key()
+            , value()
+        {}
+
+        NodePtr node; ///< Sub-trie or @c nullptr if this @p Entry is a leaf.
+        Key key;
+        Value value;
+    };
+
+    struct Node {
+        uint32_t bitmap = 0;
+        std::vector<Entry> entries;
+    };
+
+    static const int bits = 5;
+    static const int hash_bits = 64;
+
+public:
+    PersistentMap()
+        : size_(0)
+    {}
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    void clear() { root_.reset(); size_ = 0; }
+
+    /// Returns a pointer to the value associated with @p key or @c nullptr.
+    const Value* find(Key key) const {
+        auto hash = H::hash(key);
+        auto node = root_.get();
+        for (int shift = 0; node; shift += bits) {
+            if (shift >= hash_bits) {
+                for (auto& entry : node->entries) {
+                    if (H::eq(entry.key, key))
+                        return &entry.value;
+                }
+                return nullptr;
+            }
+            auto bit = fragment(hash, shift);
+            if (!(node->bitmap & bit))
+                return nullptr;
+            auto& entry = node->entries[position(node->bitmap, bit)];
+            if (!entry.node)
+                return H::eq(entry.key, key) ? &entry.value : nullptr;
+            node = entry.node.get();
+        }
+        return nullptr;
+    }
+
+    bool contains(Key key) const { return find(key) != nullptr; }
+
+    /// Associates @p value with @p key, overwriting any previous value.
+    void insert(Key key, Value value) {
+        bool added = false;
+        root_ = insert(root_.get(), H::hash(key), 0, key, value, added);
+        size_ += added ? 1 : 0;
+    }
+
+    /// Removes @p key and returns whether it was present.
+    bool erase(Key key) {
+        if (!root_)
+            return false;
+        bool removed = false;
+        root_ = erase(root_, H::hash(key), 0, key, removed);
+        size_ -= removed ? 1 : 0;
+        return removed;
+    }
+
+    /// Calls @p f for each key/value pair in unspecified order.
+    template<class F>
+    void for_each(F f) const { if (root_) for_each(root_.get(), f); }
+
+private:
+    static uint32_t fragment(uint64_t hash, int shift) { return uint32_t(1) << ((hash >> uint64_t(shift)) & 31_u64); }
+    static size_t position(uint32_t bitmap, uint32_t bit) { return bitcount(bitmap & (bit - 1)); }
+
+    static NodePtr insert(const Node* node, uint64_t hash, int shift, Key key, Value value, bool& added) {
+        auto result = node ? std::make_shared<Node>(*node) : std::make_shared<Node>();
+
+        if (shift >= hash_bits) {
+            // full hash collision: linear bucket
+            for (auto& entry : result->entries) {
+                if (H::eq(entry.key, key)) {
+                    entry.value = value;
+                    return result;
+                }
+            }
+            result->entries.emplace_back(key, value);
+            added = true;
+            return result;
+        }
+
+        auto bit = fragment(hash, shift);
+        auto pos = position(result->bitmap, bit);
+        if (!(result->bitmap & bit)) {
+            result->bitmap |= bit;
+            result->entries.emplace(result->entries.begin() + pos, key, value);
+            added = true;
+        } else {
+            auto& entry = result->entries[pos];
+            if (entry.node) {
+                entry.node = insert(entry.node.get(), hash, shift + bits, key, value, added);
+            } else if (H::eq(entry.key, key)) {
+                entry.value = value;
+            } else {
+                // push the existing leaf one level down
+                bool dummy = false;
+                auto sub = insert(nullptr, H::hash(entry.key), shift + bits, entry.key, entry.value, dummy);
+                entry = Entry(insert(sub.get(), hash, shift + bits, key, value, added));
+            }
+        }
+        return result;
+    }
+
+    static NodePtr erase(const NodePtr& node, uint64_t hash, int shift, Key key, bool& removed) {
+        if (shift >= hash_bits) {
+            for (size_t i = 0, e = node->entries.size(); i != e; ++i) {
+                if (H::eq(node->entries[i].key, key)) {
+                    removed = true;
+                    if (e == 1)
+                        return nullptr;
+                    auto result = std::make_shared<Node>(*node);
+                    result->entries.erase(result->entries.begin() + i);
+                    return result;
+                }
+            }
+            return node;
+        }
+
+        auto bit = fragment(hash, shift);
+        if (!(node->bitmap & bit))
+            return node;
+        auto pos = position(node->bitmap, bit);
+        auto& entry = node->entries[pos];
+
+        NodePtr sub;
+        if (entry.node) {
+            sub = erase(entry.node, hash, shift + bits, key, removed);
+            if (!removed)
+                return node;
+        } else if (H::eq(entry.key, key)) {
+            removed = true;
+        } else {
+            return node;
+        }
+
+        if (!sub && node->entries.size() == 1)
+            return nullptr;
+        auto result = std::make_shared<Node>(*node);
+        if (sub) {
+            result->entries[pos].node = sub;
+        } else {
+            result->bitmap &= ~bit;
+            result->entries.erase(result->entries.begin() + pos);
+        }
+        return result;
+    }
+
+    template<class F>
+    static void for_each(const Node* node, F& f) {
+        for (auto& entry : node->entries) {
+            if (entry.node)
+                for_each(entry.node.get(), f);
+            else
+                f(entry.key, entry.value);
+        }
+    }
+
+    NodePtr root_;
+    size_t size_;
+};
+
+}
+
+#endif
@@ -8,7 +8,7 @@ namespace thorin {
 
 namespace detail {
 
-static unsigned int indent = 0;
+static thread_local unsigned int indent = 0;
 
 void inc_indent() { indent++; }
 void dec_indent() { indent--; }
@@ -25,6 +25,23 @@ std::string Streamable::to_string() const {
 void Streamable::dump() const { stream(std::cout) << thorin::endl; }
 std::ostream& operator<<(std::ostream& ostream, const Streamable* s) { return s->stream(ostream); }
 
+ChunkStream::Buffer::int_type ChunkStream::Buffer::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+    auto size = chunk_size(chunks_.size());
+    chunks_.emplace_back(new char[size]);
+    auto chunk = chunks_.back().get();
+    setp(chunk, chunk + size);
+    return sputc(traits_type::to_char_type(c));
+}
+
+void ChunkStream::Buffer::write_to(std::ostream& os) const {
+    for (size_t i = 0, e = chunks_.size(); i != e; ++i) {
+        auto chunk = chunks_[i].get();
+        os.write(chunk, i + 1 == e ? pptr() - chunk : chunk_size(i));
+    }
+}
+
 std::ostream& streamf(std::ostream& os, const char* fmt) {
     while (*fmt) {
         auto next = fmt + 1;
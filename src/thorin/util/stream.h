@@ -1,9 +1,12 @@
 #ifndef THORIN_UTIL_STREAM_H
 #define THORIN_UTIL_STREAM_H
 
+#include <algorithm>
+#include <memory>
 #include <ostream>
 #include <stdexcept>
 #include <type_traits>
+#include <vector>
 
 namespace thorin {
 
@@ -83,7 +86,10 @@ namespace detail {
 
 template <class charT, class traits>
 std::basic_ostream<charT,traits>& endl(std::basic_ostream<charT,traits>& os) {
-    return os << std::endl << std::string(detail::get_indent() * 4, ' ');
+    os << std::endl;
+    for (unsigned int i = 0, e = detail::get_indent(); i != e; ++i)
+        os << "    ";
+    return os;
 }
 
 template <class charT, class traits>
@@ -139,6 +145,41 @@ StreamList<Emit, List> stream_list(const List& list, Emit emit, const char* sep
     return StreamList<Emit, List>(list, emit, sep);
 }
 
+/**
+ * A @c std::ostream that keeps its output in a list of chunks.
+ * Chunks start small and double in size up to a fixed limit, so many short streams stay cheap.
+ * In contrast to @c std::ostringstream, growing the stream never copies what has already been written,
+ * and the contents are streamed to another @c std::ostream via @p write_to instead of being copied into a @c std::string.
+ */
+class ChunkStream : public std::ostream {
+private:
+    class Buffer : public std::streambuf {
+    public:
+        bool empty() const { return chunks_.empty(); }
+        void write_to(std::ostream&) const;
+
+    protected:
+        int_type overflow(int_type) override;
+
+    private:
+        static size_t chunk_size(size_t i) { return size_t(256) << std::min(i, size_t(8)); }
+        std::vector<std::unique_ptr<char[]>> chunks_;
+    };
+
+public:
+    ChunkStream()
+        : std::ostream(nullptr)
+    {
+        rdbuf(&buffer_);
+    }
+
+    bool empty() const { return buffer_.empty(); }
+    std::ostream& write_to(std::ostream& os) const { buffer_.write_to(os); return os; }
+
+private:
+    Buffer buffer_;
+};
+
 #ifdef NDEBUG
 #   define assertf(condition, ...) do { (void)sizeof(condition); } while (false)
 #else
@@ -13,6 +13,7 @@
 #include "thorin/transform/codegen_prepare.h"
 #include "thorin/transform/dead_load_opt.h"
 #include "thorin/transform/flatten_tuples.h"
+#include "thorin/transform/fuse_kernels.h"
 #include "thorin/transform/rewrite_flow_graphs.h"
 #include "thorin/transform/hoist_enters.h"
 #include "thorin/transform/inliner.h"
@@ -991,6 +992,7 @@ void World::opt() {
     closure_conversion(*this);
     lift_builtins(*this);
     inliner(*this);
+    fuse_kernels(*this);
     hoist_enters(*this);
     dead_load_opt(*this);
     cleanup();